@@ -0,0 +1,127 @@
+// Times the column store's filter-and-aggregate kernels (scalar, SSE2, AVX2) on the same
+// random selections over the real CSV, and checks that every kernel returns exactly what the
+// scalar loop returns. Selections pick a disease and a year window, for all states or one.
+// The same selections are then answered from the rollup cube, one lookup per year, which must
+// give the scan's totals. Exits with status 1 if anything disagrees.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 bench/ColumnScanBench.cpp -o column_bench && ./column_bench [CSV] [scans]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/CSVLoader.h"
+#include "../src/ColumnStore.h"
+#include "../src/Dictionary.h"
+#include "../src/HashTable.h"
+#include "../src/RecordBatch.h"
+#include "../src/Rollup.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Random selections over the ids and years present in the rows.
+ */
+vector<ColumnFilter> randomFilters(const vector<hashTableVars>& rows, size_t count) {
+    mt19937_64 rng(5);
+    vector<ColumnFilter> filters(count);
+    for (ColumnFilter& filter : filters) {
+        const hashTableVars& a = rows[rng() % rows.size()];
+        const hashTableVars& b = rows[rng() % rows.size()];
+        filter.disease = a.disease;
+        filter.fromYear = min(a.year, b.year);
+        filter.toYear = max(a.year, b.year);
+        filter.anyState = rng() % 2 == 0;
+        filter.state = a.state;
+    }
+    return filters;
+}
+
+int main(int argc, char* argv[]) {
+    string path = argc > 1 ? argv[1] : "data/USDiseases.csv";
+    size_t scans = argc > 2 ? max(1L, atol(argv[2])) : 200;
+
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        cerr << "Can't open " << path << "\n";
+        return 1;
+    }
+    RecordBatch batch;
+    batch.decode(skipHeader(file), file.data() + file.size());
+    batch.publish(dictionaries());
+    if (batch.records.empty()) {
+        cerr << "No records in " << path << "\n";
+        return 1;
+    }
+    // Scan the deduplicated records and feed the rollups from their upserts, as the main program does
+    HashTable table;
+    RollupCube rollups;
+    vector<string_view> stateNames = dictionaries().states.snapshot();
+    for (const hashTableVars& r : batch.records) {
+        rollups.apply(r, table.insertItem(stateNames[r.state], r));
+    }
+    ColumnStore columns;
+    columns.build(table);
+    vector<ColumnFilter> filters = randomFilters(batch.records, scans);
+
+    vector<ColumnKernel> kernels{ColumnKernel::scalar};
+#ifdef COLUMN_STORE_SSE2
+    kernels.push_back(ColumnKernel::sse2);
+#endif
+    if (ColumnStore::bestKernel() == ColumnKernel::avx2) {
+        kernels.push_back(ColumnKernel::avx2);
+    }
+
+    vector<DeathAggregate> expected;
+    for (const ColumnFilter& filter : filters) {
+        expected.push_back(columns.aggregate(filter, ColumnKernel::scalar));
+    }
+
+    cout << "kernel,rows,scans,us_per_scan,gb_per_s,mismatches\n";
+    size_t failed = 0;
+    for (ColumnKernel kernel : kernels) {
+        size_t mismatches = 0;
+        auto start = steady_clock::now();
+        for (size_t i = 0; i < filters.size(); i++) {
+            DeathAggregate total = columns.aggregate(filters[i], kernel);
+            if (total.count != expected[i].count || total.sum != expected[i].sum || total.max != expected[i].max) {
+                mismatches++;
+            }
+        }
+        double seconds = duration<double>(steady_clock::now() - start).count();
+        cout << ColumnStore::kernelName(kernel) << "," << columns.size() << "," << filters.size() << ","
+             << seconds * 1e6 / filters.size() << "," << columns.scanBytes() * filters.size() / seconds / 1e9 << ","
+             << mismatches << "\n";
+        failed += mismatches;
+    }
+
+    size_t mismatches = 0;
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < filters.size(); i++) {
+        const ColumnFilter& filter = filters[i];
+        DeathAggregate total;
+        for (int year = filter.fromYear; year <= filter.toYear; year++) {
+            total.add(filter.anyState ? rollups.nationalTotal(filter.disease, year)
+                                      : rollups.stateTotal(filter.state, filter.disease, year));
+        }
+        if (total.count != expected[i].count || total.sum != expected[i].sum || total.max != expected[i].max) {
+            mismatches++;
+        }
+    }
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    cout << "rollup," << columns.size() << "," << filters.size() << "," << seconds * 1e6 / filters.size() << ",,"
+         << mismatches << "\n";
+    failed += mismatches;
+
+    if (failed > 0) {
+        cerr << failed << " selections disagree with the scalar scan\n";
+        return 1;
+    }
+    return 0;
+}
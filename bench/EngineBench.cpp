@@ -0,0 +1,418 @@
+// Benchmarks the Hash Table, Red-Black Tree and Flat Index engines on the operations the
+// program performs: build, point lookup (hit and miss), dedup-heavy insert, remove and
+// range scan. Datasets are the real CSV (if present) and synthetic rows at several scales
+// with uniform or Zipfian state popularity.
+//
+// Each measurement runs --warmup untimed repetitions, then --reps timed ones. Lookups are
+// timed one operation at a time, so their percentiles are per-operation latencies (including
+// the clock overhead reported on the "clock" row); other operations report one ns/op sample
+// per repetition. Results are printed as CSV.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread bench/EngineBench.cpp -o engine_bench && ./engine_bench
+// Options:
+//   --csv PATH      Real dataset (default data/USDiseases.csv; skipped if missing).
+//   --max-rows N    Largest synthetic dataset (default 1000000; sizes go 10K, 100K, ... up to 100M).
+//   --reps N        Timed repetitions (default 5).
+//   --warmup N      Untimed repetitions (default 1).
+//   --queries N     Lookups per repetition (default 100000).
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/CSVLoader.h"
+#include "../src/Dictionary.h"
+#include "../src/FlatIndex.h"
+#include "../src/HashTable.h"
+#include "../src/QueryResult.h"
+#include "../src/RBTree.h"
+#include "../src/RecordBatch.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Benchmark settings from the command line.
+struct Settings {
+    string csvPath = "data/USDiseases.csv";
+    size_t maxRows = 1000000;
+    size_t reps = 5;
+    size_t warmup = 1;
+    size_t queries = 100000;
+};
+
+// Rows of one dataset, with the state names they refer to.
+struct Dataset {
+    string name;                 // "csv" or "synthetic".
+    string distribution;         // "file", "uniform" or "zipf".
+    vector<hashTableVars> rows;  // Rows in insertion order.
+    vector<string> states;       // Distinct states, sorted.
+    vector<double> popularity;   // Cumulative query weight of each state in states.
+};
+
+// Timing samples in nanoseconds.
+struct Samples {
+    vector<double> ns;
+    string unit; // "op" for per-operation samples, "rep" for ns/op of a whole repetition.
+
+    double percentile(double p) {
+        if (ns.empty()) {
+            return 0;
+        }
+        size_t rank = min(ns.size() - 1, static_cast<size_t>(p * ns.size()));
+        nth_element(ns.begin(), ns.begin() + rank, ns.end());
+        return ns[rank];
+    }
+};
+
+// Insert one row under its state name.
+void insertOne(HashTable& table, string_view state, const hashTableVars& row) {
+    table.insertItem(state, row);
+}
+
+void insertOne(RBTree& tree, string_view state, const hashTableVars& row) {
+    tree.insert(state, row);
+}
+
+void insertOne(FlatIndex& index, string_view state, const hashTableVars& row) {
+    index.insert(state, row);
+}
+
+// Engines that support removing a state.
+bool eraseOne(HashTable& table, string_view state) {
+    return table.erase(state);
+}
+
+bool eraseOne(RBTree& tree, string_view state) {
+    return tree.erase(state);
+}
+
+template <typename Engine>
+bool eraseOne(Engine&, string_view) {
+    return false;
+}
+
+template <typename Engine>
+constexpr bool supportsErase() {
+    return is_same<Engine, HashTable>::value || is_same<Engine, RBTree>::value;
+}
+
+template <typename Engine>
+constexpr bool supportsRange() {
+    return !is_same<Engine, HashTable>::value;
+}
+
+template <typename Engine>
+void finish(Engine&) {}
+
+void finish(FlatIndex& index) {
+    index.finalize();
+}
+
+/**
+ * Draw an index from a cumulative weight table.
+ */
+size_t pick(const vector<double>& cumulative, mt19937_64& rng) {
+    double x = uniform_real_distribution<double>(0, cumulative.back())(rng);
+    return min<size_t>(lower_bound(cumulative.begin(), cumulative.end(), x) - cumulative.begin(),
+                       cumulative.size() - 1);
+}
+
+/**
+ * Cumulative weights for n items: all equal, or Zipfian with exponent 0.99.
+ */
+vector<double> weights(size_t n, bool zipf) {
+    vector<double> cumulative(n);
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += zipf ? 1.0 / pow(static_cast<double>(i + 1), 0.99) : 1.0;
+        cumulative[i] = total;
+    }
+    return cumulative;
+}
+
+/**
+ * Generate synthetic rows. The number of states grows with the row count (up to the
+ * dictionary's id space); each state holds up to 16 diseases x 24 years x 2 labels, so the
+ * largest datasets are dominated by duplicates.
+ */
+Dataset synthetic(size_t rows, bool zipf, mt19937_64& rng) {
+    Dataset data;
+    data.name = "synthetic";
+    data.distribution = zipf ? "zipf" : "uniform";
+
+    size_t stateCount = min<size_t>(60000, max<size_t>(50, rows / 50));
+    Dictionaries& dict = dictionaries();
+    vector<uint16_t> stateIds(stateCount), diseaseIds(16);
+    for (size_t i = 0; i < stateCount; i++) {
+        string name = "S" + to_string(100000 + i);
+        stateIds[i] = dict.states.intern(name);
+        data.states.push_back(name);
+    }
+    for (size_t i = 0; i < diseaseIds.size(); i++) {
+        diseaseIds[i] = dict.diseases.intern("Disease " + to_string(i));
+    }
+    uint8_t labels[2] = {static_cast<uint8_t>(dict.mortality.intern("mortality")),
+                         static_cast<uint8_t>(dict.mortality.intern("age-adjusted mortality rate"))};
+
+    // Popularity is assigned in a shuffled order so hot states are spread across the key space
+    vector<size_t> rank(stateCount);
+    for (size_t i = 0; i < stateCount; i++) {
+        rank[i] = i;
+    }
+    shuffle(rank.begin(), rank.end(), rng);
+    vector<double> byRank = weights(stateCount, zipf);
+    data.popularity.assign(stateCount, 0);
+    for (size_t i = 0; i < stateCount; i++) {
+        data.popularity[rank[i]] = byRank[i] - (i == 0 ? 0 : byRank[i - 1]);
+    }
+    for (size_t i = 1; i < stateCount; i++) {
+        data.popularity[i] += data.popularity[i - 1];
+    }
+
+    data.rows.reserve(rows);
+    for (size_t i = 0; i < rows; i++) {
+        size_t state = pick(data.popularity, rng);
+        data.rows.emplace_back(stateIds[state], diseaseIds[rng() % diseaseIds.size()],
+                               2000 + static_cast<int>(rng() % 24), static_cast<int>(rng() % 100000),
+                               labels[rng() % 2]);
+    }
+    return data;
+}
+
+/**
+ * Load the real CSV, or return false if it is missing.
+ */
+bool loadCSV(const string& path, Dataset& data) {
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        return false;
+    }
+    RecordBatch batch;
+    batch.decode(skipHeader(file), file.data() + file.size());
+    batch.publish(dictionaries());
+
+    data.name = "csv";
+    data.distribution = "file";
+    data.rows = batch.records;
+    vector<string_view> names = dictionaries().states.snapshot();
+    vector<double> counts(names.size(), 0);
+    for (const hashTableVars& row : data.rows) {
+        counts[row.state]++;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        if (counts[i] > 0) {
+            data.states.emplace_back(names[i]);
+        }
+    }
+    sort(data.states.begin(), data.states.end());
+    // Query states in proportion to how often they appear in the file
+    uint16_t id = 0;
+    for (const string& state : data.states) {
+        dictionaries().states.find(state, id);
+        data.popularity.push_back((data.popularity.empty() ? 0 : data.popularity.back()) + counts[id]);
+    }
+    return true;
+}
+
+/**
+ * Print one result row.
+ */
+void print(const Dataset& data, const string& engine, const string& operation, size_t ops, Samples& samples) {
+    double sum = 0;
+    for (double ns : samples.ns) {
+        sum += ns;
+    }
+    double mean = samples.ns.empty() ? 0 : sum / samples.ns.size();
+    cout << data.name << "," << data.distribution << "," << data.rows.size() << "," << data.states.size() << ","
+         << engine << "," << operation << "," << ops << "," << samples.unit << "," << samples.ns.size() << ","
+         << mean << "," << samples.percentile(0.0) << "," << samples.percentile(0.5) << ","
+         << samples.percentile(0.9) << "," << samples.percentile(0.99) << "\n";
+}
+
+/**
+ * Build an engine from every row.
+ */
+template <typename Engine>
+void build(Engine& engine, const Dataset& data, const vector<string_view>& names) {
+    for (const hashTableVars& row : data.rows) {
+        insertOne(engine, names[row.state], row);
+    }
+    finish(engine);
+}
+
+/**
+ * Run every operation against one engine and print the results.
+ */
+template <typename Engine>
+void benchEngine(const string& engineName, const Dataset& data, const Settings& settings, mt19937_64& rng) {
+    vector<string_view> names = dictionaries().states.snapshot();
+    size_t total = settings.warmup + settings.reps;
+    Samples buildSamples{{}, "rep"}, dedupSamples{{}, "rep"}, eraseSamples{{}, "rep"}, rangeSamples{{}, "rep"};
+    Samples hitSamples{{}, "op"}, missSamples{{}, "op"};
+
+    // Lookups drawn from the dataset's popularity; misses use names that were never inserted
+    vector<size_t> hitStates(settings.queries);
+    for (size_t& state : hitStates) {
+        state = pick(data.popularity, rng);
+    }
+    vector<string> missNames(min<size_t>(settings.queries, 4096));
+    for (size_t i = 0; i < missNames.size(); i++) {
+        missNames[i] = data.states[i % data.states.size()] + "#missing";
+    }
+    vector<hashTableVars> shuffled = data.rows;
+    shuffle(shuffled.begin(), shuffled.end(), rng);
+    string diseaseName = dictionaries().diseases.name(data.rows.front().disease);
+
+    size_t sink = 0;
+    for (size_t rep = 0; rep < total; rep++) {
+        bool timed = rep >= settings.warmup;
+        Engine engine;
+
+        auto start = steady_clock::now();
+        build(engine, data, names);
+        double ns = duration<double, nano>(steady_clock::now() - start).count();
+        if (timed) {
+            buildSamples.ns.push_back(ns / data.rows.size());
+        }
+
+        for (size_t state : hitStates) {
+            auto begin = steady_clock::now();
+            QueryResult result = lookup(engine, data.states[state], diseaseName);
+            sink += result.size();
+            auto end = steady_clock::now();
+            if (timed) {
+                hitSamples.ns.push_back(duration<double, nano>(end - begin).count());
+            }
+        }
+        for (size_t i = 0; i < settings.queries; i++) {
+            auto begin = steady_clock::now();
+            sink += engine.find(missNames[i % missNames.size()]) != nullptr;
+            auto end = steady_clock::now();
+            if (timed) {
+                missSamples.ns.push_back(duration<double, nano>(end - begin).count());
+            }
+        }
+
+        // Every row is already present, so each insert takes the duplicate path
+        start = steady_clock::now();
+        for (const hashTableVars& row : shuffled) {
+            insertOne(engine, names[row.state], row);
+        }
+        ns = duration<double, nano>(steady_clock::now() - start).count();
+        if (timed) {
+            dedupSamples.ns.push_back(ns / shuffled.size());
+        }
+
+        if constexpr (supportsRange<Engine>()) {
+            // Scan windows of about 1% of the states
+            size_t width = max<size_t>(1, data.states.size() / 100);
+            size_t scans = 100;
+            start = steady_clock::now();
+            for (size_t i = 0; i < scans; i++) {
+                size_t low = rng() % data.states.size();
+                size_t high = min(data.states.size() - 1, low + width - 1);
+                engine.forEachInRange(data.states[low], data.states[high], [&](const string&, const StateRecords& r) {
+                    sink += r.size();
+                });
+            }
+            ns = duration<double, nano>(steady_clock::now() - start).count();
+            if (timed) {
+                rangeSamples.ns.push_back(ns / scans);
+            }
+        }
+
+        if constexpr (supportsErase<Engine>()) {
+            vector<size_t> order(data.states.size());
+            for (size_t i = 0; i < order.size(); i++) {
+                order[i] = i;
+            }
+            shuffle(order.begin(), order.end(), rng);
+            start = steady_clock::now();
+            for (size_t i : order) {
+                sink += eraseOne(engine, data.states[i]);
+            }
+            ns = duration<double, nano>(steady_clock::now() - start).count();
+            if (timed) {
+                eraseSamples.ns.push_back(ns / order.size());
+            }
+        }
+    }
+
+    print(data, engineName, "build", data.rows.size(), buildSamples);
+    print(data, engineName, "lookup_hit", settings.queries, hitSamples);
+    print(data, engineName, "lookup_miss", settings.queries, missSamples);
+    print(data, engineName, "dedup_insert", shuffled.size(), dedupSamples);
+    if (supportsRange<Engine>()) {
+        print(data, engineName, "range_scan", 100, rangeSamples);
+    }
+    if (supportsErase<Engine>()) {
+        print(data, engineName, "remove", data.states.size(), eraseSamples);
+    }
+    if (sink == 0) {
+        cerr << "no results\n";
+    }
+}
+
+/**
+ * Run all engines on one dataset.
+ */
+void benchDataset(const Dataset& data, const Settings& settings, mt19937_64& rng) {
+    benchEngine<HashTable>("hash_table", data, settings, rng);
+    benchEngine<RBTree>("rb_tree", data, settings, rng);
+    benchEngine<FlatIndex>("flat_index", data, settings, rng);
+}
+
+int main(int argc, char* argv[]) {
+    Settings settings;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if (arg == "--csv") {
+            settings.csvPath = argv[i + 1];
+        } else if (arg == "--max-rows") {
+            settings.maxRows = strtoull(argv[i + 1], nullptr, 10);
+        } else if (arg == "--reps") {
+            settings.reps = max<size_t>(1, strtoull(argv[i + 1], nullptr, 10));
+        } else if (arg == "--warmup") {
+            settings.warmup = strtoull(argv[i + 1], nullptr, 10);
+        } else if (arg == "--queries") {
+            settings.queries = max<size_t>(1, strtoull(argv[i + 1], nullptr, 10));
+        } else {
+            cerr << "unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    // Cost of one steady_clock::now() pair, included in every per-operation sample
+    Samples clockSamples{{}, "op"};
+    for (int i = 0; i < 100000; i++) {
+        auto begin = steady_clock::now();
+        auto end = steady_clock::now();
+        clockSamples.ns.push_back(duration<double, nano>(end - begin).count());
+    }
+    cout << "dataset,distribution,rows,states,engine,operation,ops,sample,samples,mean_ns,min_ns,p50_ns,p90_ns,p99_ns\n";
+    Dataset none;
+    none.name = "clock";
+    none.distribution = "-";
+    print(none, "-", "overhead", clockSamples.ns.size(), clockSamples);
+
+    mt19937_64 rng(42);
+    Dataset csv;
+    if (loadCSV(settings.csvPath, csv) && !csv.rows.empty()) {
+        benchDataset(csv, settings, rng);
+    } else {
+        cerr << "skipping csv dataset: " << settings.csvPath << " not found\n";
+    }
+
+    for (size_t rows = 10000; rows <= settings.maxRows; rows *= 10) {
+        for (bool zipf : {false, true}) {
+            benchDataset(synthetic(rows, zipf, rng), settings, rng);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Compares the open-addressing HashTable with the original chained layout
+// (100 fixed buckets, character-sum hash) as the number of keys grows.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 bench/HashTableBench.cpp -o hashtable_bench && ./hashtable_bench
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/HashTable.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// The original string-based record.
+struct ChainedRecord {
+    string disease;
+    int year;
+    int deathCount;
+    string isMortality;
+
+    ChainedRecord(const string& d, int y, int dc, const string& im)
+            : disease(d), year(y), deathCount(dc), isMortality(im) {}
+};
+
+// The original hash table layout, kept here as the baseline.
+class ChainedHashTable {
+private:
+    static const int hashGroups = 100;
+    vector<list<pair<string, list<ChainedRecord>>>> table;
+
+public:
+    ChainedHashTable() {
+        table.resize(hashGroups);
+    }
+
+    int hashFunction(string_view key) {
+        int hash = 0;
+        for (char ch : key) {
+            hash += ch;
+        }
+        return hash % hashGroups;
+    }
+
+    void insertItem(string_view key, string_view disease, int year, int deathCount, string_view isMortality) {
+        auto& cell = table[hashFunction(key)];
+        for (auto& bucket : cell) {
+            if (bucket.first == key) {
+                for (auto& entry : bucket.second) {
+                    if (entry.year == year && entry.disease == disease && entry.isMortality == isMortality) {
+                        if (deathCount > entry.deathCount) {
+                            entry.deathCount = deathCount;
+                        }
+                        return;
+                    }
+                }
+                bucket.second.emplace_back(string(disease), year, deathCount, string(isMortality));
+                return;
+            }
+        }
+        list<ChainedRecord> diseaseList;
+        diseaseList.emplace_back(string(disease), year, deathCount, string(isMortality));
+        cell.emplace_back(string(key), std::move(diseaseList));
+    }
+
+    const list<ChainedRecord>* find(string_view key) {
+        for (const auto& bucket : table[hashFunction(key)]) {
+            if (bucket.first == key) {
+                return &bucket.second;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// Insert one "Cancer / 2020 / mortality" record under key.
+void insertOne(ChainedHashTable& table, const string& key) {
+    table.insertItem(key, "Cancer", 2020, 1, "mortality");
+}
+
+void insertOne(HashTable& table, const string& key) {
+    static const hashTableVars record(0, dictionaries().diseases.intern("Cancer"), 2020, 1,
+                                      static_cast<uint8_t>(dictionaries().mortality.intern("mortality")));
+    table.insertItem(key, record);
+}
+
+/**
+ * Time inserting every key once and then looking each one up (in shuffled order).
+ * @param keys The keys to use.
+ * @param order Lookup order (a permutation of key indices).
+ * @param insertNs Receives the mean insert time per key in nanoseconds.
+ * @param lookupNs Receives the mean lookup time per key in nanoseconds.
+ */
+template <typename Table>
+void run(const vector<string>& keys, const vector<size_t>& order, double& insertNs, double& lookupNs) {
+    Table table;
+    auto start = steady_clock::now();
+    for (const string& key : keys) {
+        insertOne(table, key);
+    }
+    insertNs = duration<double, nano>(steady_clock::now() - start).count() / keys.size();
+
+    size_t found = 0;
+    start = steady_clock::now();
+    for (size_t i : order) {
+        found += table.find(keys[i]) != nullptr;
+    }
+    lookupNs = duration<double, nano>(steady_clock::now() - start).count() / keys.size();
+    if (found != keys.size()) {
+        cout << "lookup mismatch\n";
+    }
+}
+
+int main() {
+    const size_t sizes[] = {50, 1000, 10000, 100000, 1000000};
+    const size_t chainedLimit = 100000; // The chained table is quadratic beyond this.
+    mt19937_64 rng(42);
+
+    cout << "keys,chained_insert_ns,chained_lookup_ns,open_insert_ns,open_lookup_ns\n";
+    for (size_t n : sizes) {
+        vector<string> keys;
+        keys.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            keys.push_back("State " + to_string(rng() % 1000000000) + "-" + to_string(i));
+        }
+        vector<size_t> order(n);
+        for (size_t i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        shuffle(order.begin(), order.end(), rng);
+
+        double chainedInsert = 0, chainedLookup = 0, openInsert, openLookup;
+        if (n <= chainedLimit) {
+            run<ChainedHashTable>(keys, order, chainedInsert, chainedLookup);
+        }
+        run<HashTable>(keys, order, openInsert, openLookup);
+
+        cout << n << ",";
+        if (n <= chainedLimit) {
+            cout << chainedInsert << "," << chainedLookup;
+        } else {
+            cout << "-,-";
+        }
+        cout << "," << openInsert << "," << openLookup << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+// Load generator for the query server (main --serve). Each connection runs on its own thread
+// and keeps a fixed number of requests in flight (the pipeline depth), sending a new one as
+// each response line arrives; per-request latency is measured from send to response. Queries
+// are (state, disease) pairs sampled from the CSV, with 5% unknown states mixed in. Every
+// combination of the connection counts and depths given is run in turn.
+//
+// Build from the repository root, start a server, then run:
+//   g++ -std=c++17 -O2 -pthread bench/QueryLoadGen.cpp -o query_loadgen
+//   ./main --serve 7070 &
+//   ./query_loadgen ADDR [connections,...] [depth,...] [requests] [CSV]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../src/CSVLoader.h"
+#include "../src/Dictionary.h"
+#include "../src/Parallel.h"
+#include "../src/QueryServer.h"
+#include "../src/RecordBatch.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// What one connection measured.
+struct ConnectionResult {
+    vector<long long> latencies; // Nanoseconds from send to response, per request.
+    size_t ok = 0;               // "ok" responses.
+    size_t notFound = 0;         // "state_not_found" and "disease_not_found" responses.
+    size_t errors = 0;           // Any other response.
+    string failure;              // Set if the connection broke.
+};
+
+/**
+ * Send requests[first..last) over one connection with up to depth requests in flight.
+ */
+void runConnection(const ServerAddress& address, const vector<string>& requests, size_t first, size_t last,
+                   size_t depth, ConnectionResult& result) {
+    int fd = connectToServer(address, result.failure);
+    if (fd < 0) {
+        return;
+    }
+    result.latencies.reserve(last - first);
+    deque<steady_clock::time_point> sentAt;
+    string pending;
+    string partial; // Bytes of a response line still incomplete.
+    char buffer[64 * 1024];
+    size_t next = first;
+
+    while (result.latencies.size() < last - first) {
+        // Top the pipeline up and send the new requests in one write
+        pending.clear();
+        steady_clock::time_point now = steady_clock::now();
+        while (next < last && sentAt.size() < depth) {
+            pending += requests[next++];
+            sentAt.push_back(now);
+        }
+        for (size_t done = 0; done < pending.size();) {
+            ssize_t put = send(fd, pending.data() + done, pending.size() - done, MSG_NOSIGNAL);
+            if (put <= 0) {
+                result.failure = "send failed";
+                close(fd);
+                return;
+            }
+            done += static_cast<size_t>(put);
+        }
+
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got <= 0) {
+            result.failure = "server closed the connection";
+            close(fd);
+            return;
+        }
+        now = steady_clock::now();
+        // A response can straddle reads
+        partial.append(buffer, static_cast<size_t>(got));
+        size_t start = 0, newline;
+        while ((newline = partial.find('\n', start)) != string::npos) {
+            string_view line(partial.data() + start, newline - start);
+            if (line.rfind("ok\t", 0) == 0) {
+                result.ok++;
+            } else if (line == "state_not_found" || line == "disease_not_found") {
+                result.notFound++;
+            } else {
+                result.errors++;
+            }
+            result.latencies.push_back(duration_cast<nanoseconds>(now - sentAt.front()).count());
+            sentAt.pop_front();
+            start = newline + 1;
+        }
+        partial.erase(0, start);
+    }
+    close(fd);
+}
+
+/**
+ * Parse a comma-separated list of positive counts.
+ */
+vector<size_t> parseList(const string& text) {
+    vector<size_t> values;
+    stringstream ss(text);
+    string item;
+    while (getline(ss, item, ',')) {
+        long value = atol(item.c_str());
+        if (value > 0) {
+            values.push_back(static_cast<size_t>(value));
+        }
+    }
+    return values;
+}
+
+int main(int argc, char* argv[]) {
+    ServerAddress address;
+    if (argc < 2 || !parseServerAddress(argv[1], address)) {
+        cerr << "Usage: " << argv[0] << " PORT|PATH [connections,...] [depth,...] [requests] [CSV]\n";
+        return 1;
+    }
+    vector<size_t> connectionCounts = parseList(argc > 2 ? argv[2] : "1,4,16");
+    vector<size_t> depths = parseList(argc > 3 ? argv[3] : "1,16");
+    size_t total = argc > 4 ? max(1L, atol(argv[4])) : 1000000;
+    string path = argc > 5 ? argv[5] : "data/USDiseases.csv";
+
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        cerr << "Can't open " << path << "\n";
+        return 1;
+    }
+    RecordBatch batch;
+    batch.decode(skipHeader(file), file.data() + file.size());
+    batch.publish(dictionaries());
+    if (batch.records.empty()) {
+        cerr << "No records in " << path << "\n";
+        return 1;
+    }
+    vector<string_view> states = dictionaries().states.snapshot();
+    vector<string_view> diseases = dictionaries().diseases.snapshot();
+    mt19937_64 rng(11);
+    vector<string> requests(total);
+    for (string& request : requests) {
+        const hashTableVars& row = batch.records[rng() % batch.records.size()];
+        request = rng() % 20 == 0 ? "Nowhere" : string(states[row.state]);
+        request += '\t';
+        request += diseases[row.disease];
+        request += '\n';
+    }
+
+    cout << "connections,depth,requests,seconds,requests_per_s,p50_us,p90_us,p99_us,p999_us,max_us,ok,not_found,errors\n";
+    for (size_t connections : connectionCounts) {
+        for (size_t depth : depths) {
+            vector<ConnectionResult> results(connections);
+            auto start = steady_clock::now();
+            parallelFor(connections, [&](size_t i) {
+                runConnection(address, requests, total * i / connections, total * (i + 1) / connections, depth,
+                              results[i]);
+            });
+            double seconds = duration<double>(steady_clock::now() - start).count();
+
+            vector<long long> latencies;
+            size_t ok = 0, notFound = 0, errors = 0;
+            for (const ConnectionResult& result : results) {
+                if (!result.failure.empty()) {
+                    cerr << result.failure << "\n";
+                    return 1;
+                }
+                latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+                ok += result.ok;
+                notFound += result.notFound;
+                errors += result.errors;
+            }
+            sort(latencies.begin(), latencies.end());
+            auto percentile = [&](double p) {
+                size_t rank = min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+                return latencies[rank] / 1e3;
+            };
+            cout << connections << "," << depth << "," << latencies.size() << "," << seconds << ","
+                 << static_cast<long long>(latencies.size() / seconds) << "," << percentile(0.50) << ","
+                 << percentile(0.90) << "," << percentile(0.99) << "," << percentile(0.999) << ","
+                 << latencies.back() / 1e3 << "," << ok << "," << notFound << "," << errors << endl;
+        }
+    }
+    return 0;
+}
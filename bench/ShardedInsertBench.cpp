@@ -0,0 +1,110 @@
+// Measures how insert throughput of the ShardedHashTable scales with the number of writer
+// threads, on the decoded records of the full CSV. A single-shard table (one global lock)
+// is run alongside as the contended baseline, and every result is checked against a
+// serial HashTable build.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread bench/ShardedInsertBench.cpp -o sharded_bench && ./sharded_bench [CSV] [reps] [max-threads]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/CSVLoader.h"
+#include "../src/Dictionary.h"
+#include "../src/HashTable.h"
+#include "../src/Parallel.h"
+#include "../src/RecordBatch.h"
+#include "../src/ShardedHashTable.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Sum of death counts and number of records, to compare tables built in different orders.
+ */
+template <typename Table>
+pair<long long, size_t> checksum(const Table& table) {
+    long long deaths = 0;
+    size_t records = 0;
+    table.forEach([&](const string&, const StateRecords& stateRecords) {
+        for (const hashTableVars& r : stateRecords) {
+            deaths += r.deathCount;
+            records++;
+        }
+    });
+    return {deaths, records};
+}
+
+/**
+ * Insert every record with the given number of threads, each taking a contiguous slice.
+ * @return Wall-clock time in seconds.
+ */
+double insertAll(ShardedHashTable& table, const vector<hashTableVars>& rows, const vector<string_view>& names,
+                 size_t threads) {
+    auto start = steady_clock::now();
+    parallelFor(threads, [&](size_t t) {
+        size_t first = rows.size() * t / threads;
+        size_t last = rows.size() * (t + 1) / threads;
+        for (size_t i = first; i < last; i++) {
+            table.insertItem(names[rows[i].state], rows[i]);
+        }
+    });
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    string path = argc > 1 ? argv[1] : "data/USDiseases.csv";
+    int reps = argc > 2 ? max(1, atoi(argv[2])) : 3;
+    size_t maxThreads = argc > 3 ? max(1, atoi(argv[3])) : workerCount();
+
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        cerr << "Can't open " << path << "\n";
+        return 1;
+    }
+    RecordBatch batch;
+    batch.decode(skipHeader(file), file.data() + file.size());
+    batch.publish(dictionaries());
+    const vector<hashTableVars>& rows = batch.records;
+    vector<string_view> names = dictionaries().states.snapshot();
+
+    HashTable serial;
+    auto start = steady_clock::now();
+    for (const hashTableVars& r : rows) {
+        serial.insertItem(names[r.state], r);
+    }
+    double serialSeconds = duration<double>(steady_clock::now() - start).count();
+    auto expected = checksum(serial);
+
+    cout << "threads,shards,rows,best_ms,mrows_per_s,speedup_vs_serial\n";
+    cout << "1,serial," << rows.size() << "," << serialSeconds * 1e3 << "," << rows.size() / serialSeconds / 1e6
+         << ",1\n";
+
+    vector<size_t> threadCounts;
+    for (size_t t = 1; t < maxThreads; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    for (size_t shards : {size_t(1), size_t(64)}) {
+        for (size_t threads : threadCounts) {
+            double best = 0;
+            for (int rep = 0; rep < reps; rep++) {
+                ShardedHashTable table(shards);
+                double seconds = insertAll(table, rows, names, threads);
+                best = rep == 0 ? seconds : min(best, seconds);
+                if (checksum(table) != expected) {
+                    cerr << "mismatch with " << threads << " threads and " << shards << " shards\n";
+                    return 1;
+                }
+            }
+            cout << threads << "," << shards << "," << rows.size() << "," << best * 1e3 << ","
+                 << rows.size() / best / 1e6 << "," << serialSeconds / best << "\n";
+        }
+    }
+    return 0;
+}
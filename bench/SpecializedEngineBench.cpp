@@ -0,0 +1,176 @@
+// Compares the string-keyed HashTable and RBTree with instantiations of the same templates
+// keyed on interned integer state ids (BasicHashTable<uint16_t>, BasicRBTree<uint16_t>), where
+// hashing and comparing a key is a few instructions instead of a pass over a string.
+// Datasets are the real CSV (55 states) and a synthetic set with many long keys.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 bench/SpecializedEngineBench.cpp -o specialized_bench && ./specialized_bench [CSV] [reps]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/CSVLoader.h"
+#include "../src/Dictionary.h"
+#include "../src/HashTable.h"
+#include "../src/RBTree.h"
+#include "../src/RecordBatch.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Rows of one dataset and the name of each state id.
+struct Dataset {
+    string name;
+    vector<hashTableVars> rows;
+    vector<string> names; // State id -> name.
+};
+
+// Insert one row; the engines name their insert differently.
+template <typename Key>
+void insertOne(BasicHashTable<Key>& table, typename BasicHashTable<Key>::KeyView key, const hashTableVars& row) {
+    table.insertItem(key, row);
+}
+
+template <typename Key>
+void insertOne(BasicRBTree<Key>& tree, typename BasicRBTree<Key>::KeyView key, const hashTableVars& row) {
+    tree.insert(key, row);
+}
+
+// The key of a row for each key type: the state name, or the interned id itself.
+string_view keyOf(const Dataset& data, const hashTableVars& row, string_view*) {
+    return data.names[row.state];
+}
+
+uint16_t keyOf(const Dataset&, const hashTableVars& row, uint16_t*) {
+    return row.state;
+}
+
+/**
+ * Build an engine from every row and time it.
+ * @return Best nanoseconds per inserted row over the repetitions.
+ */
+template <typename Engine>
+double timeBuild(const Dataset& data, int reps) {
+    using View = typename Engine::KeyView;
+    double best = 0;
+    for (int rep = 0; rep < reps; rep++) {
+        Engine engine;
+        auto start = steady_clock::now();
+        for (const hashTableVars& row : data.rows) {
+            insertOne(engine, keyOf(data, row, static_cast<View*>(nullptr)), row);
+        }
+        double ns = duration<double, nano>(steady_clock::now() - start).count() / data.rows.size();
+        best = rep == 0 ? ns : min(best, ns);
+    }
+    return best;
+}
+
+/**
+ * Run a batch of hit lookups against a built engine and time the whole batch.
+ * @return Best nanoseconds per lookup over the repetitions.
+ */
+template <typename Engine>
+double timeLookups(const Dataset& data, const vector<uint16_t>& queries, int reps) {
+    using View = typename Engine::KeyView;
+    Engine engine;
+    for (const hashTableVars& row : data.rows) {
+        insertOne(engine, keyOf(data, row, static_cast<View*>(nullptr)), row);
+    }
+    hashTableVars probe;
+    vector<View> keys;
+    keys.reserve(queries.size());
+    for (uint16_t id : queries) {
+        probe.state = id;
+        keys.push_back(keyOf(data, probe, static_cast<View*>(nullptr)));
+    }
+
+    double best = 0;
+    size_t found = 0;
+    for (int rep = 0; rep < reps; rep++) {
+        auto start = steady_clock::now();
+        for (View key : keys) {
+            found += engine.find(key)->size();
+        }
+        double ns = duration<double, nano>(steady_clock::now() - start).count() / keys.size();
+        best = rep == 0 ? ns : min(best, ns);
+    }
+    if (found == 0) {
+        cerr << "no lookups matched\n";
+    }
+    return best;
+}
+
+/**
+ * Synthetic rows over many distinct long state keys, uniformly spread.
+ */
+Dataset syntheticDataset(size_t keys, size_t rows) {
+    Dataset data;
+    data.name = "synthetic";
+    mt19937_64 rng(42);
+    for (size_t i = 0; i < keys; i++) {
+        string name = "Region " + to_string(rng() % 1000000) + " / district " + to_string(i);
+        data.names.push_back(name);
+    }
+    for (size_t i = 0; i < rows; i++) {
+        data.rows.emplace_back(static_cast<uint16_t>(rng() % keys), static_cast<uint16_t>(rng() % 20),
+                               2000 + static_cast<int>(rng() % 21), static_cast<int>(rng() % 100000),
+                               static_cast<uint8_t>(rng() % 3));
+    }
+    return data;
+}
+
+/**
+ * Print the string-keyed and id-keyed timings of one engine on one dataset.
+ */
+template <typename StringEngine, typename IdEngine>
+void compare(const Dataset& data, const string& engine, const vector<uint16_t>& queries, int reps) {
+    double buildString = timeBuild<StringEngine>(data, reps);
+    double buildId = timeBuild<IdEngine>(data, reps);
+    double lookupString = timeLookups<StringEngine>(data, queries, reps);
+    double lookupId = timeLookups<IdEngine>(data, queries, reps);
+    cout << data.name << "," << engine << ",build," << data.names.size() << "," << data.rows.size() << ","
+         << buildString << "," << buildId << "," << buildString / buildId << "\n";
+    cout << data.name << "," << engine << ",lookup_hit," << data.names.size() << "," << queries.size() << ","
+         << lookupString << "," << lookupId << "," << lookupString / lookupId << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    string path = argc > 1 ? argv[1] : "data/USDiseases.csv";
+    int reps = argc > 2 ? max(1, atoi(argv[2])) : 3;
+
+    vector<Dataset> datasets;
+    MappedFile file(path);
+    if (file.isOpen()) {
+        RecordBatch batch;
+        batch.decode(skipHeader(file), file.data() + file.size());
+        batch.publish(dictionaries());
+        Dataset csv;
+        csv.name = "csv";
+        csv.rows = std::move(batch.records);
+        for (string_view name : dictionaries().states.snapshot()) {
+            csv.names.emplace_back(name);
+        }
+        datasets.push_back(std::move(csv));
+    } else {
+        cerr << "Can't open " << path << "; running the synthetic dataset only\n";
+    }
+    datasets.push_back(syntheticDataset(20000, 1000000));
+
+    cout << "dataset,engine,operation,keys,ops,string_key_ns_per_op,id_key_ns_per_op,speedup\n";
+    for (const Dataset& data : datasets) {
+        mt19937_64 rng(7);
+        vector<uint16_t> queries(1000000);
+        for (uint16_t& q : queries) {
+            q = data.rows[rng() % data.rows.size()].state;
+        }
+        compare<HashTable, BasicHashTable<uint16_t>>(data, "hash", queries, reps);
+        compare<RBTree, BasicRBTree<uint16_t>>(data, "rbtree", queries, reps);
+    }
+    return 0;
+}
@@ -4,16 +4,87 @@
 #include <list>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <algorithm>
+#include <limits>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 
 #include <chrono>
 
+#include "src/CSVLoader.h"
+#include "src/Dictionary.h"
+#include "src/RecordBatch.h"
+#include "src/Parallel.h"
 #include "src/HashTable.h"
 #include "src/RBTree.h"
+#include "src/FlatIndex.h"
+#include "src/Snapshot.h"
+#include "src/BatchQuery.h"
+#include "src/Stats.h"
+#include "src/Ingest.h"
+#include "src/Rcu.h"
+#include "src/ColumnStore.h"
+#include "src/StreamLoader.h"
+#include "src/ResultCache.h"
+#include "src/Rollup.h"
+#include "src/QueryServer.h"
+#include "src/NameIndex.h"
 
 using namespace std;
 using namespace std::chrono;
 
+// Command-line options.
+struct Options {
+    string csvPath = "data/USDiseases.csv"; // CSV dataset to load.
+    string buildSnapshotPath;               // --build-snapshot FILE: write a snapshot of the CSV and exit.
+    string loadSnapshotPath;                // --load-snapshot FILE: load records from a snapshot instead of the CSV.
+    string streamPath;                      // --stream FILE: read the CSV ("-" = stdin) in bounded memory.
+    string batchPath;                       // --batch FILE: run the queries in FILE ("-" = stdin) and exit.
+    string serveAddress;                    // --serve PORT|PATH: answer queries over a socket until stopped.
+    string outputPath;                      // --output FILE: batch results file (default stdout).
+    string structures = "hash,rbtree,flat"; // --structures LIST: structures used in batch mode.
+    bool json = false;                      // --format json: batch results as JSON lines instead of CSV.
+    bool dumpStats = false;                 // --dump-stats: print engine counters to stderr on exit.
+    size_t threads = workerCount();         // --threads N: batch or server worker threads.
+    size_t cacheBytes = 16 << 20;           // --cache-mb N: memory cap of the query result cache (0 = off).
+};
+
+// One published version of the data structures. Once published only its result cache changes.
+struct EngineSet {
+    HashTable ht;
+    RBTree rbt;
+    FlatIndex flat;
+    ColumnStore columns;         // The same records by column, for full filter-and-aggregate scans.
+    RollupCube rollups;          // Totals by state, disease and year, for aggregate lookups.
+    // Every state name, for case-insensitive, prefix and fuzzy matching; shared between
+    // versions until a refresh adds a name.
+    shared_ptr<const NameIndex> stateNames = make_shared<NameIndex>();
+    shared_ptr<const NameIndex> diseaseNames = make_shared<NameIndex>(); // Every disease name, likewise.
+    mutable ResultCache cache;   // Lookups already answered from this version.
+};
+
+// The data structures selected by the user and their build times.
+struct Engines {
+    RcuCell<EngineSet> versions; // The published structures; queries read them without locking.
+    bool useHashTable = false;  // Whether the Hash Table is built and queried.
+    bool useRBTree = false;     // Whether the Red-Black Tree is built and queried.
+    bool useFlatIndex = false;  // Whether the Flat Index is built and queried.
+    long long buildTimeHT = 0;   // Build time for the Hash Table in microseconds.
+    long long buildTimeRBT = 0;  // Build time for the Red-Black Tree in microseconds.
+    long long buildTimeFlat = 0; // Build time for the Flat Index in microseconds.
+    size_t cacheBytes = 0;       // Memory cap of each version's result cache.
+    unordered_map<uint64_t, uint32_t> columnRows; // Column store row of each record key, kept by refreshes.
+
+    string csvPath;                // CSV the structures were loaded from.
+    uint64_t csvOffset = 0;        // Bytes of csvPath already loaded; a refresh reads from here.
+    thread refresher;              // Background refresh, if one was started.
+    atomic<bool> refreshing{false}; // Whether a refresh is running.
+};
+
 
 // tick tock functions for timing
 /**
@@ -24,6 +95,15 @@ void tick(steady_clock::time_point &start) {
     start = steady_clock::now();
 }
 
+/**
+ * Print the duration of a finished operation.
+ * @param operation Name of the operation to display in the output.
+ * @param duration The duration in microseconds.
+ */
+void report(const string& operation, long long duration) {
+    cout << endl << operation << " took " << duration << " microseconds\n";
+}
+
 /**
  * Stop timing a process and calculate the duration.
  * @param start The starting time point of the process.
@@ -33,7 +113,7 @@ void tick(steady_clock::time_point &start) {
 void tock(steady_clock::time_point &start, const string& operation, long long &duration) {
     auto end = steady_clock::now();
     duration = duration_cast<microseconds>(end - start).count();
-    cout << endl << operation << " took " << duration << " microseconds\n";
+    report(operation, duration);
 }
 
 // Helper functions for display
@@ -45,12 +125,14 @@ void displayMenu() {
     cout << "1. Hash Table\n";
     cout << "2. Red-Black Tree\n";
     cout << "3. Both\n";
-    cout << "Enter your choice (1, 2, or 3): ";
+    cout << "4. Flat Index (sorted, Eytzinger layout)\n";
+    cout << "5. All three\n";
+    cout << "Enter your choice (1-5): ";
 }
 
 /**
  * Get the user's choice of data structure and validate input.
- * @return The user's choice as an integer (1, 2, or 3).
+ * @return The user's choice as an integer (1 to 5).
  */
 int getUserChoice() {
     int choice;
@@ -64,9 +146,9 @@ int getUserChoice() {
         // Check for valid input
         if (cin.fail()) {
             cin.clear(); // Clear the error flag
-            cout << "Invalid input. Please enter a number (1, 2, or 3).\n";
-        } else if (choice < 1 || choice > 3) {
-            cout << "Invalid choice. Please enter a number (1, 2, or 3).\n";
+            cout << "Invalid input. Please enter a number (1-5).\n";
+        } else if (choice < 1 || choice > 5) {
+            cout << "Invalid choice. Please enter a number (1-5).\n";
         } else {
             break; // Valid choice, exit loop
         }
@@ -76,192 +158,1224 @@ int getUserChoice() {
 
 
 /**
- * Build the specified data structures (Hash Table and/or Red-Black Tree) using data from a CSV file.
- * @param ht HashTable object to populate (if buildHashTable is true).
- * @param rbt RBTree object to populate (if buildRBTree is true).
- * @param buildHashTable Boolean indicating whether to build the Hash Table.
- * @param buildRBTree Boolean indicating whether to build the Red-Black Tree.
- * @param buildTimeHT Reference to the variable to store the build time for the Hash Table.
- * @param buildTimeRBT Reference to the variable to store the build time for the Red-Black Tree.
+ * Insert decoded records into the Hash Table.
+ * @param ht HashTable object to populate.
+ * @param first First record to insert.
+ * @param last One past the last record.
+ * @param stateNames State names indexed by state id.
+ * @param rollups Totals to keep up to date with each upsert, if not null.
  */
-void buildDataStructures(HashTable &ht, RBTree &rbt, bool buildHashTable, bool buildRBTree,
-                         long long &buildTimeHT, long long &buildTimeRBT) {
-    ifstream file("data/USDiseases.csv");
-    string line;
-    if (!file.is_open()) {
+void insertRecords(HashTable &ht, const hashTableVars* first, const hashTableVars* last,
+                   const vector<string_view> &stateNames, RollupCube* rollups = nullptr) {
+    for (; first != last; ++first) {
+        UpsertResult change = ht.insertItem(stateNames[first->state], *first);
+        if (rollups != nullptr) {
+            rollups->apply(*first, change);
+        }
+    }
+}
+
+/**
+ * Insert decoded records into the Red-Black Tree.
+ * @param rbt RBTree object to populate.
+ * @param first First record to insert.
+ * @param last One past the last record.
+ * @param stateNames State names indexed by state id.
+ * @param rollups Totals to keep up to date with each upsert, if not null.
+ */
+void insertRecords(RBTree &rbt, const hashTableVars* first, const hashTableVars* last,
+                   const vector<string_view> &stateNames, RollupCube* rollups = nullptr) {
+    for (; first != last; ++first) {
+        UpsertResult change = rbt.insert(stateNames[first->state], *first);
+        if (rollups != nullptr) {
+            rollups->apply(*first, change);
+        }
+    }
+}
+
+/**
+ * Insert decoded records into the Flat Index.
+ * @param flat FlatIndex object to populate.
+ * @param first First record to insert.
+ * @param last One past the last record.
+ * @param stateNames State names indexed by state id.
+ * @param rollups Totals to keep up to date with each upsert, if not null.
+ */
+void insertRecords(FlatIndex &flat, const hashTableVars* first, const hashTableVars* last,
+                   const vector<string_view> &stateNames, RollupCube* rollups = nullptr) {
+    for (; first != last; ++first) {
+        UpsertResult change = flat.insert(stateNames[first->state], *first);
+        if (rollups != nullptr) {
+            rollups->apply(*first, change);
+        }
+    }
+}
+
+/**
+ * Print how the selected structures compare on one operation.
+ * @param timings (structure name, duration in microseconds) for each structure that ran.
+ * @param operation Verb for the message, e.g. "building".
+ */
+void printComparison(vector<pair<string, long long>> timings, const string& operation) {
+    if (timings.size() < 2) {
+        return;
+    }
+    sort(timings.begin(), timings.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+    long long margin = timings[1].second - timings[0].second;
+    if (timings.size() == 2) {
+        cout << timings[0].first << " was faster in " << operation << " by " << margin << " microseconds.\n\n";
+    } else {
+        cout << timings[0].first << " was fastest in " << operation << ", " << margin
+             << " microseconds ahead of " << timings[1].first << ".\n\n";
+    }
+}
+
+/**
+ * Build one structure from per-chunk batches. Chunk 0 goes straight into the target while the
+ * other chunks fill thread-local partial structures, which are then merged in file order so the
+ * result matches a serial build.
+ * @param target The structure to populate.
+ * @param batches The decoded chunks, in file order.
+ * @param rollups Totals to feed from every upsert into the target (chunk 0's inserts and the
+ *                merges), if not null.
+ * @return The wall-clock build time (inserts plus merge) in microseconds.
+ */
+template <typename Structure>
+long long buildPartitioned(Structure &target, const vector<RecordBatch> &batches, RollupCube* rollups = nullptr) {
+    steady_clock::time_point start = steady_clock::now();
+    vector<string_view> stateNames = dictionaries().states.snapshot();
+    vector<Structure> partials(batches.size() > 1 ? batches.size() - 1 : 0);
+    parallelFor(batches.size(), [&](size_t i) {
+        const vector<hashTableVars>& records = batches[i].records;
+        insertRecords(i == 0 ? target : partials[i - 1], records.data(), records.data() + records.size(), stateNames,
+                      i == 0 ? rollups : nullptr);
+    });
+    for (const Structure& partial : partials) {
+        if (rollups == nullptr) {
+            target.merge(partial);
+        } else {
+            target.merge(partial, [&](const hashTableVars& record, const UpsertResult& change) {
+                rollups->apply(record, change);
+            });
+        }
+    }
+    return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+/**
+ * Parse a CSV file into batches. The file is split into newline-aligned chunks that are parsed
+ * in parallel, once, into batches that every structure consumes.
+ * @param path The CSV file.
+ * @param batches Receives the decoded chunks, in file order.
+ * @param offset Receives the number of bytes loaded, up to the last complete line.
+ * @return False if the file can't be opened.
+ */
+bool loadCSV(const string& path, vector<RecordBatch> &batches, uint64_t &offset) {
+    MappedFile file(path);
+    if (!file.isOpen()) {
         cout << "Can't open file" << endl;
+        return false;
+    }
+
+    steady_clock::time_point startParse = steady_clock::now();
+    auto ranges = splitLines(skipHeader(file), file.data() + file.size(), workerCount());
+    batches = vector<RecordBatch>(ranges.size());
+    parallelFor(ranges.size(), [&](size_t i) {
+        batches[i].decode(ranges[i].first, ranges[i].second);
+    });
+    // Hand out shared ids in file order, then rewrite each chunk's records in parallel
+    for (RecordBatch& batch : batches) {
+        batch.publish(dictionaries(), false);
+    }
+    parallelFor(batches.size(), [&](size_t i) {
+        batches[i].remap();
+    });
+    offset = static_cast<uint64_t>(lastLineEnd(file.data(), file.data() + file.size()) - file.data());
+    long long parseTime;
+    tock(startParse, "CSV parse", parseTime);
+    return true;
+}
+
+/**
+ * Split decoded records into batches, one per worker, so they build in parallel like a parsed CSV.
+ * @param records The records.
+ * @param batches Receives at least one batch.
+ */
+void splitRecords(const vector<hashTableVars> &records, vector<RecordBatch> &batches) {
+    size_t parts = min(workerCount(), max<size_t>(1, records.size()));
+    batches = vector<RecordBatch>(parts);
+    for (size_t i = 0; i < parts; i++) {
+        auto first = records.begin() + records.size() * i / parts;
+        auto last = records.begin() + records.size() * (i + 1) / parts;
+        batches[i].records.assign(first, last);
+    }
+}
+
+/**
+ * Load the records of a snapshot file into batches, one per worker.
+ * @param path The snapshot file.
+ * @param batches Receives the records.
+ * @param offset Receives the number of CSV bytes the snapshot was built from.
+ * @return False if the snapshot can't be read.
+ */
+bool loadSnapshot(const string& path, vector<RecordBatch> &batches, uint64_t &offset) {
+    steady_clock::time_point start = steady_clock::now();
+    vector<hashTableVars> records;
+    uint64_t sourceLines;
+    string error;
+    if (!readSnapshot(path, records, sourceLines, offset, error)) {
+        cout << "Can't load snapshot: " << error << endl;
+        return false;
+    }
+
+    splitRecords(records, batches);
+    batches[0].lines = sourceLines;
+    long long loadTime;
+    tock(start, "Snapshot load", loadTime);
+    return true;
+}
+
+/**
+ * Read a CSV of any size in fixed-size buffers, keeping only the deduplicated records, and
+ * report the memory used.
+ * @param path The CSV file, or "-" for stdin.
+ * @param batches Receives the deduplicated records.
+ * @param offset Receives the number of bytes read, up to the last complete line.
+ * @return False if the file can't be opened.
+ */
+bool loadStream(const string& path, vector<RecordBatch> &batches, uint64_t &offset) {
+    ifstream file;
+    if (path != "-") {
+        file.open(path, ios::binary);
+        if (!file.is_open()) {
+            cout << "Can't open file" << endl;
+            return false;
+        }
+    }
+    istream& in = path == "-" ? cin : file;
+
+    steady_clock::time_point start = steady_clock::now();
+    StreamSummary summary;
+    vector<hashTableVars> records;
+    {
+        HashTable table;
+        StreamLoader loader;
+        summary = loader.load(in, table);
+        table.forEach([&](const string&, const StateRecords& stateRecords) {
+            records.insert(records.end(), stateRecords.begin(), stateRecords.end());
+        });
+    }
+    splitRecords(records, batches);
+    batches[0].lines = summary.lines;
+    offset = summary.bytes;
+    long long streamTime;
+    tock(start, "CSV stream", streamTime);
+    cout << "Streamed " << summary.lines << " lines (" << summary.bytes / (1 << 20) << " MB) in "
+         << summary.buffers << " buffers of up to " << summary.peakBufferBytes / 1024 << " KB into "
+         << records.size() << " distinct records; the reader waited for the parser "
+         << summary.readerStalls << " times\n";
+    cout << "Peak RSS: " << peakRSSBytes() / (1 << 20) << " MB\n\n";
+    return true;
+}
+
+/**
+ * Load the records from the source named in the options: a snapshot, a streamed CSV or the
+ * memory-mapped CSV.
+ * @param options The command-line options.
+ * @param batches Receives the records.
+ * @param offset Receives the number of CSV bytes loaded.
+ * @return False if the source can't be read.
+ */
+bool loadRecords(const Options &options, vector<RecordBatch> &batches, uint64_t &offset) {
+    if (!options.loadSnapshotPath.empty()) {
+        return loadSnapshot(options.loadSnapshotPath, batches, offset);
+    }
+    if (!options.streamPath.empty()) {
+        return loadStream(options.streamPath, batches, offset);
+    }
+    return loadCSV(options.csvPath, batches, offset);
+}
+
+/**
+ * Fill the column store from whichever structure was built; they all hold the same records.
+ * @param engines Which structures were selected.
+ * @param set The structures.
+ */
+void buildColumns(const Engines &engines, EngineSet &set) {
+    if (engines.useHashTable) {
+        set.columns.build(set.ht);
+    } else if (engines.useRBTree) {
+        set.columns.build(set.rbt);
+    } else {
+        set.columns.build(set.flat);
+    }
+}
+
+/**
+ * Index the names of a dictionary, reusing a previous index if no name was interned since.
+ * @param all Snapshot of the dictionary's names.
+ * @param previous The index of an earlier version, or nullptr.
+ * @return The index of every name in all.
+ */
+shared_ptr<const NameIndex> indexNames(const vector<string_view> &all, const shared_ptr<const NameIndex> &previous) {
+    if (previous != nullptr && previous->sourceCount() == all.size()) {
+        return previous;
+    }
+    auto index = make_shared<NameIndex>();
+    index->build(all);
+    return index;
+}
+
+/**
+ * Index every state and disease name interned so far.
+ * @param set The structures the indexes belong to.
+ * @param previous The version set replaces, whose indexes are shared when still current, or nullptr.
+ */
+void buildNameIndexes(EngineSet &set, const EngineSet *previous = nullptr) {
+    set.stateNames = indexNames(dictionaries().states.snapshot(), previous ? previous->stateNames : nullptr);
+    set.diseaseNames = indexNames(dictionaries().diseases.snapshot(), previous ? previous->diseaseNames : nullptr);
+}
+
+// Key of a record's (state, disease, year, isMortality), for finding its column store row.
+uint64_t recordKey(const hashTableVars &r) {
+    return (static_cast<uint64_t>(r.state) << 40) | (static_cast<uint64_t>(r.disease) << 24) |
+           (static_cast<uint64_t>(r.year) << 8) | r.isMortality;
+}
+
+/**
+ * Add refreshed records to a column store copied from the current version: new records are
+ * appended and raised death counts updated in place, so only the chunks they fall in are copied.
+ * @param engines Holds the row of every record key, indexed on the first refresh.
+ * @param columns The new version's columns.
+ * @param batch The new records.
+ */
+void refreshColumns(Engines &engines, ColumnStore &columns, const RecordBatch &batch) {
+    if (engines.columnRows.size() != columns.size()) {
+        engines.columnRows.clear();
+        for (size_t row = 0; row < columns.size(); row++) {
+            engines.columnRows.emplace(recordKey(columns.row(row)), static_cast<uint32_t>(row));
+        }
+    }
+    for (const hashTableVars& r : batch.records) {
+        auto found = engines.columnRows.emplace(recordKey(r), static_cast<uint32_t>(columns.size()));
+        if (found.second) {
+            columns.append(r);
+        } else if (StateRecords::DedupPolicy::replaces(columns.row(found.first->second).deathCount, r.deathCount)) {
+            columns.setDeathCount(found.first->second, r.deathCount);
+        }
+    }
+}
+
+/**
+ * Build the selected data structures from decoded batches.
+ * @param engines The structures to populate; their build times are stored alongside.
+ * @param batches The decoded records, in file order.
+ */
+void buildDataStructures(Engines &engines, const vector<RecordBatch> &batches) {
+    auto built = make_unique<EngineSet>();
+    // The rollups are fed from the upserts of the first structure built; the build time of
+    // that structure includes them
+    RollupCube* rollups = &built->rollups;
+    if (engines.useHashTable) {
+        engines.buildTimeHT = buildPartitioned(built->ht, batches, rollups);
+        report("Hash Table build", engines.buildTimeHT);
+        rollups = nullptr;
+    }
+    if (engines.useRBTree) {
+        engines.buildTimeRBT = buildPartitioned(built->rbt, batches, rollups);
+        report("Red-Black Tree build", engines.buildTimeRBT);
+        rollups = nullptr;
+    }
+    if (engines.useFlatIndex) {
+        steady_clock::time_point startFlat = steady_clock::now();
+        buildPartitioned(built->flat, batches, rollups);
+        built->flat.finalize();
+        engines.buildTimeFlat = duration_cast<microseconds>(steady_clock::now() - startFlat).count();
+        report("Flat Index build", engines.buildTimeFlat);
+    }
+    steady_clock::time_point startColumns = steady_clock::now();
+    buildColumns(engines, *built);
+    engines.columnRows.clear();
+    long long columnTime;
+    tock(startColumns, "Column store build", columnTime);
+    steady_clock::time_point startNames = steady_clock::now();
+    buildNameIndexes(*built);
+    long long nameTime;
+    tock(startNames, "Name index build", nameTime);
+    built->cache.setCapacity(engines.cacheBytes);
+    engines.versions.publish(std::move(built));
+
+    size_t count = 0;
+    for (const RecordBatch& batch : batches) {
+        count += batch.lines;
+    }
+    cout << "Total records processed: " << count << "\n\n";
+}
+
+/**
+ * Build a Hash Table from the CSV and write it to a snapshot file.
+ * @param options The command-line options.
+ * @return The process exit code.
+ */
+int buildSnapshot(const Options &options) {
+    vector<RecordBatch> batches;
+    uint64_t offset;
+    if (!loadRecords(options, batches, offset)) {
+        return 1;
+    }
+    HashTable ht;
+    long long buildTime = buildPartitioned(ht, batches);
+    report("Hash Table build", buildTime);
+
+    uint64_t lines = 0;
+    for (const RecordBatch& batch : batches) {
+        lines += batch.lines;
+    }
+    steady_clock::time_point start = steady_clock::now();
+    string error;
+    if (!writeSnapshot(options.buildSnapshotPath, ht, lines, offset, error)) {
+        cout << "Can't write snapshot: " << error << endl;
+        return 1;
+    }
+    long long writeTime;
+    tock(start, "Snapshot write", writeTime);
+    cout << "Snapshot written to " << options.buildSnapshotPath << "\n";
+    return 0;
+}
+
+/**
+ * Parse the command-line options.
+ * @param argc Argument count.
+ * @param argv Arguments.
+ * @param options Receives the options.
+ * @return False (after printing usage) if the arguments are invalid.
+ */
+bool parseOptions(int argc, char* argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--build-snapshot" && i + 1 < argc) {
+            options.buildSnapshotPath = argv[++i];
+        } else if (arg == "--load-snapshot" && i + 1 < argc) {
+            options.loadSnapshotPath = argv[++i];
+        } else if (arg == "--csv" && i + 1 < argc) {
+            options.csvPath = argv[++i];
+        } else if (arg == "--stream" && i + 1 < argc) {
+            options.streamPath = argv[++i];
+        } else if (arg == "--batch" && i + 1 < argc) {
+            options.batchPath = argv[++i];
+        } else if (arg == "--serve" && i + 1 < argc) {
+            options.serveAddress = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            options.outputPath = argv[++i];
+        } else if (arg == "--structures" && i + 1 < argc) {
+            options.structures = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc && (string(argv[i + 1]) == "csv" || string(argv[i + 1]) == "json")) {
+            options.json = string(argv[++i]) == "json";
+        } else if (arg == "--dump-stats") {
+            options.dumpStats = true;
+        } else if (arg == "--threads" && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            options.threads = atoi(argv[++i]);
+        } else if (arg == "--cache-mb" && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            options.cacheBytes = static_cast<size_t>(atoi(argv[++i])) << 20;
+        } else {
+            cout << "Usage: " << argv[0] << " [--csv FILE | --stream FILE|-] [--build-snapshot FILE | --load-snapshot FILE]\n"
+                 << "       [--batch FILE|- [--format csv|json] [--output FILE] [--threads N]\n"
+                 << "        [--structures hash,rbtree,flat]] [--serve PORT|PATH [--threads N]]\n"
+                 << "       [--cache-mb N] [--dump-stats]\n";
+            return false;
+        }
+    }
+    // Workers read published versions, and the main thread needs a reader slot too
+    if (options.threads > EpochDomain::maxReaders - 1) {
+        options.threads = EpochDomain::maxReaders - 1;
+        cerr << "Using " << options.threads << " threads, the most that can read at once\n";
+    }
+    if (options.streamPath == "-" && options.buildSnapshotPath.empty() && options.serveAddress.empty() &&
+        (options.batchPath.empty() || options.batchPath == "-")) {
+        cout << "--stream - reads the CSV from stdin, which is only free with --build-snapshot, --serve or --batch FILE\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Pick the structures named by --structures for a non-interactive mode.
+ * @param options The command-line options.
+ * @param engines Receives the selection and the cache size.
+ * @return False (with a message on stderr) if none was named.
+ */
+bool selectStructures(const Options &options, Engines &engines) {
+    engines.cacheBytes = options.cacheBytes;
+    engines.useHashTable = options.structures.find("hash") != string::npos;
+    engines.useRBTree = options.structures.find("rbtree") != string::npos;
+    engines.useFlatIndex = options.structures.find("flat") != string::npos;
+    if (!engines.useHashTable && !engines.useRBTree && !engines.useFlatIndex) {
+        cerr << "No structures selected; use --structures hash,rbtree,flat\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Run a file of queries against the selected structures without prompting, write the results
+ * as CSV or JSON lines and report throughput and latency for each structure.
+ * Progress and summaries go to stderr so the results can be piped.
+ * @param options The command-line options.
+ * @return The process exit code.
+ */
+int runBatchMode(const Options &options) {
+    Engines engines;
+    if (!selectStructures(options, engines)) {
+        return 1;
+    }
+
+    vector<BatchQuery> queries;
+    size_t malformed;
+    if (options.batchPath == "-") {
+        malformed = readBatchQueries(cin, queries);
+    } else {
+        ifstream in(options.batchPath);
+        if (!in.is_open()) {
+            cerr << "Can't open query file " << options.batchPath << "\n";
+            return 1;
+        }
+        malformed = readBatchQueries(in, queries);
+    }
+    if (malformed > 0) {
+        cerr << "Skipped " << malformed << " malformed query lines\n";
+    }
+
+    // Keep stdout for results only while loading reports its progress
+    ostream results(cout.rdbuf());
+    cout.rdbuf(cerr.rdbuf());
+    vector<RecordBatch> batches;
+    uint64_t offset;
+    bool loaded = loadRecords(options, batches, offset);
+    if (loaded) {
+        buildDataStructures(engines, batches);
+    }
+    cout.rdbuf(results.rdbuf());
+    if (!loaded) {
+        return 1;
+    }
+
+    ofstream file;
+    if (!options.outputPath.empty()) {
+        file.open(options.outputPath);
+        if (!file.is_open()) {
+            cerr << "Can't open output file " << options.outputPath << "\n";
+            return 1;
+        }
+        results.rdbuf(file.rdbuf());
+    }
+    OutputBuffer buffer(results);
+    if (!options.json) {
+        buffer << "structure,query,state,disease,status,year,death_count,mortality\n";
+    }
+
+    auto version = engines.versions.read();
+    ResultCache* cache = options.cacheBytes > 0 ? &version->cache : nullptr;
+    auto run = [&](const auto &structure, char engine, const string &name) {
+        vector<BatchResult> batchResults;
+        CacheCounters before = version->cache.counters();
+        BatchSummary summary = runBatch(structure, queries, options.threads, batchResults, cache, engine);
+        writeBatchResults(buffer, name, queries, batchResults, options.json);
+        cerr << name << ": " << summary.queries << " queries on " << options.threads << " threads, "
+             << static_cast<long long>(summary.queriesPerSecond()) << " queries/sec, p50 "
+             << summary.p50Nanos << " ns, p99 " << summary.p99Nanos << " ns";
+        if (cache != nullptr) {
+            CacheCounters after = cache->counters();
+            cerr << ", cache " << after.hits - before.hits << " hits / " << after.misses - before.misses
+                 << " misses (" << after.entries << " entries, " << after.bytes / 1024 << " KB)";
+        }
+        cerr << "\n";
+    };
+    if (engines.useHashTable) {
+        run(version->ht, 'h', "Hash Table");
+    }
+    if (engines.useRBTree) {
+        run(version->rbt, 'r', "Red-Black Tree");
+    }
+    if (engines.useFlatIndex) {
+        run(version->flat, 'f', "Flat Index");
+    }
+    buffer.flush();
+    results.flush();
+    return results ? 0 : 1;
+}
+
+/**
+ * Answer one server request line, "state<TAB>disease" or "state,disease", from the current
+ * version of one structure. The response is one line: "ok", the number of matching records
+ * and a "year,death_count,mortality" field per record, tab-separated; or "state_not_found",
+ * "disease_not_found" or "malformed".
+ * @param structure The structure to query.
+ * @param cache Result cache of the structure's version, or nullptr.
+ * @param engine Cache tag of the structure.
+ * @param line The request line.
+ * @param out Receives the response line.
+ */
+template <typename Structure>
+void answerRequest(const Structure &structure, ResultCache* cache, char engine, string_view line, string &out) {
+    string_view state, disease;
+    if (!splitQueryLine(line, state, disease)) {
+        out += "malformed\n";
+        return;
+    }
+    size_t matches = 0;
+    QueryResult result = cache != nullptr ? cache->lookup(structure, engine, state, disease, matches)
+                                          : lookup(structure, state, disease);
+    if (!result.stateFound()) {
+        out += "state_not_found\n";
         return;
     }
+    if (cache == nullptr) {
+        matches = result.size();
+    }
+    if (matches == 0) {
+        out += "disease_not_found\n";
+        return;
+    }
+    const Dictionary& mortality = dictionaries().mortality;
+    out += "ok\t";
+    out += to_string(matches);
+    result.forEach([&](const hashTableVars& entry) {
+        out += '\t';
+        out += to_string(static_cast<int>(entry.year));
+        out += ',';
+        out += to_string(static_cast<int>(entry.deathCount));
+        out += ',';
+        out += mortality.name(entry.isMortality);
+    });
+    out += '\n';
+}
+
+/**
+ * Answer a server name request: "?complete<TAB>state|disease<TAB>prefix[<TAB>limit]" lists the
+ * names starting with prefix, "?suggest<TAB>state|disease<TAB>text[<TAB>limit]" the names
+ * within two edits of text, both ignoring case. The response is "ok", the number of names and
+ * the names, tab-separated; or "malformed", which includes texts over 256 characters.
+ * @param set The structures whose name indexes answer.
+ * @param line The request line.
+ * @param out Receives the response line.
+ */
+void answerNameRequest(const EngineSet &set, string_view line, string &out) {
+    vector<string_view> fields;
+    while (true) {
+        size_t tab = line.find('\t');
+        fields.push_back(line.substr(0, tab));
+        if (tab == string_view::npos) {
+            break;
+        }
+        line.remove_prefix(tab + 1);
+    }
+    bool complete = fields[0] == "?complete";
+    if ((!complete && fields[0] != "?suggest") || fields.size() < 3 || fields.size() > 4 ||
+        (fields[1] != "state" && fields[1] != "disease") || fields[2].size() > 256) {
+        out += "malformed\n";
+        return;
+    }
+    size_t limit = complete ? 10 : 5;
+    if (fields.size() == 4) {
+        limit = static_cast<size_t>(max(0L, atol(string(fields[3]).c_str())));
+    }
+    const NameIndex& index = fields[1] == "state" ? *set.stateNames : *set.diseaseNames;
+    vector<string_view> names = complete ? index.complete(fields[2], limit) : index.suggest(fields[2], 2, limit);
+    out += "ok\t";
+    out += to_string(names.size());
+    for (string_view name : names) {
+        out += '\t';
+        out.append(name.data(), name.size());
+    }
+    out += '\n';
+}
 
-    getline(file, line); // Skip header line
+/**
+ * Load the records once, then answer pipelined query lines from any number of clients over a
+ * localhost TCP port or a Unix socket until SIGINT or SIGTERM. Requests are answered by the
+ * first structure named in --structures (hash, then rbtree, then flat).
+ * @param options The command-line options.
+ * @return The process exit code.
+ */
+int runServerMode(const Options &options) {
+    ServerAddress address;
+    if (!parseServerAddress(options.serveAddress, address)) {
+        cerr << "Invalid --serve address " << options.serveAddress << "; use a port number or a socket path\n";
+        return 1;
+    }
+    Engines engines;
+    if (!selectStructures(options, engines)) {
+        return 1;
+    }
+    // Only the answering structure is built
+    engines.useRBTree = engines.useRBTree && !engines.useHashTable;
+    engines.useFlatIndex = engines.useFlatIndex && !engines.useHashTable && !engines.useRBTree;
 
-    int count = 0;
+    ostream results(cout.rdbuf());
+    cout.rdbuf(cerr.rdbuf());
+    vector<RecordBatch> batches;
+    bool loaded = loadRecords(options, batches, engines.csvOffset);
+    if (loaded) {
+        buildDataStructures(engines, batches);
+    }
+    cout.rdbuf(results.rdbuf());
+    if (!loaded) {
+        return 1;
+    }
+    batches.clear();
 
-    if (buildHashTable) {
-        // Timing for hash table
-        steady_clock::time_point startHT = steady_clock::now();
-        while (getline(file, line)) {
-            istringstream ss(line);
-            string year, state, diseaseType, isMortality, deathCount;
-            int yearAsint, deathAsInt;
+    const bool cached = options.cacheBytes > 0;
+    QueryServer server(options.threads, [&](string_view line, string &out) {
+        auto version = engines.versions.read();
+        ResultCache* cache = cached ? &version->cache : nullptr;
+        if (!line.empty() && line[0] == '?') {
+            answerNameRequest(*version, line, out);
+        } else if (engines.useHashTable) {
+            answerRequest(version->ht, cache, 'h', line, out);
+        } else if (engines.useRBTree) {
+            answerRequest(version->rbt, cache, 'r', line, out);
+        } else {
+            answerRequest(version->flat, cache, 'f', line, out);
+        }
+    });
+    const char* structure = engines.useHashTable ? "Hash Table" : engines.useRBTree ? "Red-Black Tree" : "Flat Index";
+    bool ran = server.run(address, [&] {
+        cerr << "Serving " << structure << " queries on " << address.describe() << " with " << options.threads
+             << " worker threads; stop with Ctrl-C\n";
+    });
+    if (!ran) {
+        return 1;
+    }
+    const ServerCounters& totals = server.counters();
+    cerr << "Stopped after " << totals.requests << " requests on " << totals.connections << " connections ("
+         << totals.bytesIn << " bytes in, " << totals.bytesOut << " bytes out)\n";
+    return 0;
+}
 
-            getline(ss, year, ',');
-            yearAsint = stoi(year);
+/**
+ * Run one query against a structure and time the lookup alone; the results are formatted
+ * and printed after the clock stops.
+ * @param structure The structure to query.
+ * @param engine Cache tag of the structure.
+ * @param cache Result cache of the version the structure belongs to.
+ * @param name Name of the structure for the output.
+ * @param state The state to look up.
+ * @param disease The disease to look up.
+ * @param timings Receives (name, duration).
+ */
+template <typename Structure>
+void timedSearch(const Structure &structure, char engine, ResultCache &cache, const string& name, const string& state,
+                 const string& disease, vector<pair<string, long long>> &timings) {
+    steady_clock::time_point start = steady_clock::now();
+    size_t matches;
+    bool hit = false;
+    QueryResult result = cache.lookup(structure, engine, state, disease, matches, &hit);
+    long long duration = duration_cast<microseconds>(steady_clock::now() - start).count();
 
-            getline(ss, state, ',');
-            getline(ss, diseaseType, ',');
-            getline(ss, isMortality, ',');
-            getline(ss, deathCount, ',');
-            deathAsInt = stoi(deathCount);
+    {
+        OutputBuffer out(cout);
+        formatDeathCount(out, state, disease, result);
+    }
+    report(name + (hit ? " search (cached)" : " search"), duration);
+    timings.emplace_back(name, duration);
+}
 
-            // Convert isMortality to lowercase
-            transform(isMortality.begin(), isMortality.end(), isMortality.begin(), ::tolower);
+/**
+ * Read a year window such as "2015 2020" (a single year is a one-year window).
+ * @param fromYear Receives the first year.
+ * @param toYear Receives the last year.
+ * @return True if at least one year was entered.
+ */
+bool readYearWindow(int &fromYear, int &toYear) {
+    string line;
+    cout << "Enter the year window (e.g. 2015 2020): ";
+    getline(cin, line);
+    istringstream ss(line);
+    if (!(ss >> fromYear)) {
+        cout << "Invalid year window.\n\n";
+        return false;
+    }
+    if (!(ss >> toYear)) {
+        toYear = fromYear;
+    }
+    if (fromYear > toYear) {
+        swap(fromYear, toYear);
+    }
+    return true;
+}
 
-            if (isMortality.find("mortality") != string::npos) {
-                ht.insertItem(state, hashTableVars(diseaseType, yearAsint, deathAsInt, isMortality));
+/**
+ * Read a state range such as "A M". The high end matches by prefix, so "M" includes Michigan.
+ * An empty line selects every state.
+ * @param low Receives the low end ("" = open).
+ * @param high Receives the high end ("" = open).
+ */
+void readStateRange(string &low, string &high) {
+    cout << "Enter the first and last state separated by '-' (e.g. A-M, or press Enter for all states): ";
+    string line;
+    getline(cin, line);
+    size_t dash = line.find('-');
+    low = line.substr(0, dash);
+    high = dash == string::npos ? line : line.substr(dash + 1);
+    auto trim = [](string &text) {
+        text.erase(0, text.find_first_not_of(' '));
+        text.erase(text.find_last_not_of(' ') + 1);
+    };
+    trim(low);
+    trim(high);
+}
+
+/**
+ * Range and aggregate queries, served by the ordered Red-Black Tree.
+ * "Range" lists one disease's records for a state range and year window; "Stats" prints the
+ * sum, maximum and average deaths over the same selection and the top states by deaths.
+ * @param versions The published structures; the tree is read from the current version.
+ * @param command "Range" or "Stats".
+ */
+void processRangeQuery(const RcuCell<EngineSet> &versions, const string& command) {
+    string disease, low, high;
+    int fromYear, toYear;
+    cout << "Enter the disease/cause of death: ";
+    getline(cin, disease);
+    if (!readYearWindow(fromYear, toYear)) {
+        return;
+    }
+    readStateRange(low, high);
+
+    uint16_t diseaseId;
+    if (!dictionaries().diseases.find(disease, diseaseId)) {
+        cout << "Disease " << disease << " not found.\n\n";
+        return;
+    }
+    size_t topN = 0;
+    if (command != "Range") {
+        string topLine;
+        cout << "How many top states to list? ";
+        getline(cin, topLine);
+        istringstream(topLine) >> topN;
+    }
+
+    // Pin a version only once all input is read, so an idle prompt doesn't hold back reclamation
+    long long duration;
+    steady_clock::time_point start = steady_clock::now();
+    auto version = versions.read();
+    const RBTree& rbt = version->rbt;
+    if (command == "Range") {
+        vector<pair<const string*, const hashTableVars*>> rows;
+        rbt.forEachInRange(low, high, [&](const string& state, const StateRecords& records) {
+            records.forDiseaseInYears(diseaseId, fromYear, toYear, [&](const hashTableVars& entry) {
+                rows.emplace_back(&state, &entry);
+            });
+        });
+        duration = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+        {
+            OutputBuffer out(cout);
+            const Dictionary& mortality = dictionaries().mortality;
+            for (const auto& row : rows) {
+                out << "State: " << *row.first << " Disease: " << disease
+                    << " Year: " << static_cast<int>(row.second->year)
+                    << " Death Count: " << static_cast<int>(row.second->deathCount)
+                    << " Mortality: " << string_view(mortality.name(row.second->isMortality)) << '\n';
             }
+        }
+        report("Red-Black Tree range scan", duration);
+        cout << "\n";
+        return;
+    }
+
+    DeathAggregate total = rbt.aggregate(low, high, diseaseId, fromYear, toYear);
+    auto top = rbt.topStates(low, high, diseaseId, fromYear, toYear, topN);
+    tock(start, "Red-Black Tree aggregate query", duration);
+
+    cout << disease << ", " << fromYear << "-" << toYear << ": " << total.count << " records";
+    if (total.count > 0) {
+        cout << ", total deaths " << total.sum << ", max " << total.max << ", average " << total.average();
+    }
+    cout << "\n";
+    for (size_t i = 0; i < top.size(); i++) {
+        cout << "  " << (i + 1) << ". " << top[i].first << ": " << top[i].second.sum << " deaths\n";
+    }
+    cout << "\n";
+}
+
+/**
+ * Filter-and-aggregate scan over the column store: every record of one disease in a year
+ * window, optionally for a single state, with the fastest kernel the CPU supports.
+ * @param versions The published structures; the columns are read from the current version.
+ */
+void processColumnScan(const RcuCell<EngineSet> &versions) {
+    string disease, state;
+    int fromYear, toYear;
+    cout << "Enter the disease/cause of death: ";
+    getline(cin, disease);
+    if (!readYearWindow(fromYear, toYear)) {
+        return;
+    }
+    cout << "Enter a state (or press Enter for all states): ";
+    getline(cin, state);
+
+    ColumnFilter filter;
+    filter.fromYear = static_cast<uint16_t>(max(0, min(fromYear, 0xFFFF)));
+    filter.toYear = static_cast<uint16_t>(max(0, min(toYear, 0xFFFF)));
+    filter.anyState = state.empty();
+    if (!dictionaries().diseases.find(disease, filter.disease)) {
+        cout << "Disease " << disease << " not found.\n\n";
+        return;
+    }
+    if (!filter.anyState && !dictionaries().states.find(state, filter.state)) {
+        cout << "State " << state << " not found.\n\n";
+        return;
+    }
+
+    auto version = versions.read();
+    const ColumnStore& columns = version->columns;
+    steady_clock::time_point start = steady_clock::now();
+    DeathAggregate total = columns.aggregate(filter);
+    long long duration = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+    cout << disease << ", " << fromYear << "-" << toYear << (filter.anyState ? "" : ", " + state) << ": "
+         << total.count << " records";
+    if (total.count > 0) {
+        cout << ", total deaths " << total.sum << ", max " << total.max << ", average " << total.average();
+    }
+    cout << "\nColumn scan of " << columns.size() << " rows took " << duration << " nanoseconds ("
+         << ColumnStore::kernelName(ColumnKernel::best) << ")\n\n";
+}
+
+/**
+ * Yearly totals of one disease, nationally or for one state, read from the rollup cube, with
+ * the change from the year before. Each year is one cube lookup.
+ * @param versions The published structures; the rollups are read from the current version.
+ */
+void processRollupQuery(const RcuCell<EngineSet> &versions) {
+    string disease, state;
+    int fromYear, toYear;
+    cout << "Enter the disease/cause of death: ";
+    getline(cin, disease);
+    if (!readYearWindow(fromYear, toYear)) {
+        return;
+    }
+    cout << "Enter a state (or press Enter for national totals): ";
+    getline(cin, state);
 
-            count += 1;
+    uint16_t diseaseId, stateId = 0;
+    if (!dictionaries().diseases.find(disease, diseaseId)) {
+        cout << "Disease " << disease << " not found.\n\n";
+        return;
+    }
+    if (!state.empty() && !dictionaries().states.find(state, stateId)) {
+        cout << "State " << state << " not found.\n\n";
+        return;
+    }
+
+    auto version = versions.read();
+    const RollupCube& rollups = version->rollups;
+    vector<pair<DeathAggregate, long long>> years; // (totals, change from the year before) per year.
+    DeathAggregate total;
+    steady_clock::time_point start = steady_clock::now();
+    for (int year = fromYear; year <= toYear; year++) {
+        if (state.empty()) {
+            years.emplace_back(rollups.nationalTotal(diseaseId, year), rollups.nationalChange(diseaseId, year));
+        } else {
+            years.emplace_back(rollups.stateTotal(stateId, diseaseId, year), rollups.stateChange(stateId, diseaseId, year));
         }
-        file.clear(); // Clear EOF flag
-        file.seekg(0); // Rewind file stream
-        getline(file, line); // Skip header line
-        tock(startHT, "Hash Table build", buildTimeHT);
-    }
-
-    if (buildRBTree) {
-        // Timing for red-black tree
-        steady_clock::time_point startRBT = steady_clock::now();
-        while (getline(file, line)) {
-            istringstream ss(line);
-            string year, state, diseaseType, isMortality, deathCount;
-            int yearAsint, deathAsInt;
-
-            getline(ss, year, ',');
-            yearAsint = stoi(year);
-
-            getline(ss, state, ',');
-            getline(ss, diseaseType, ',');
-            getline(ss, isMortality, ',');
-            getline(ss, deathCount, ',');
-            deathAsInt = stoi(deathCount);
-
-            // Convert isMortality to lowercase
-            transform(isMortality.begin(), isMortality.end(), isMortality.begin(), ::tolower);
-
-            if (isMortality.find("mortality") != string::npos) {
-                rbt.insert(state, hashTableVars(diseaseType, yearAsint, deathAsInt, isMortality));
-            }
+        total.add(years.back().first);
+    }
+    long long duration = duration_cast<nanoseconds>(steady_clock::now() - start).count();
 
-            count += 1;
+    cout << disease << (state.empty() ? ", all states" : ", " + state) << ":\n";
+    for (int year = fromYear; year <= toYear; year++) {
+        const auto& entry = years[static_cast<size_t>(year - fromYear)];
+        if (entry.first.count == 0) {
+            continue;
         }
-        file.close();
-        tock(startRBT, "Red-Black Tree build", buildTimeRBT);
+        cout << "  " << year << ": " << entry.first.sum << " deaths over " << entry.first.count << " records ("
+             << (entry.second >= 0 ? "+" : "") << entry.second << " from " << (year - 1) << ")\n";
     }
+    cout << "Total: " << total.sum << " deaths over " << total.count << " records\n";
+    cout << "Rollup lookups took " << duration << " nanoseconds\n\n";
+}
 
-    cout << "Total records processed: " << count << "\n\n";
+/**
+ * Publish a new version of the selected structures with refreshed records added. The new
+ * version starts as a copy of the current one, so queries keep reading the current version,
+ * without waiting, until the new one is swapped in. The copy shares each state's records and
+ * each column chunk with the current version until the refresh changes them, so a refresh
+ * costs the size of the delta plus the per-state parts of the structures, not the dataset.
+ * @param engines The structures to update.
+ * @param batch The new records.
+ */
+void applyRefresh(Engines &engines, const RecordBatch &batch) {
+    auto next = make_unique<EngineSet>();
+    auto current = engines.versions.read();
+    if (engines.useHashTable) {
+        next->ht = current->ht;
+    }
+    if (engines.useRBTree) {
+        next->rbt = current->rbt;
+    }
+    if (engines.useFlatIndex) {
+        next->flat = current->flat;
+    }
+
+    vector<string_view> stateNames = dictionaries().states.snapshot();
+    const hashTableVars* first = batch.records.data();
+    const hashTableVars* last = first + batch.records.size();
+    // The rollups start from the current totals and follow the upserts of the first structure
+    next->rollups = current->rollups;
+    RollupCube* rollups = &next->rollups;
+    if (engines.useHashTable) {
+        insertRecords(next->ht, first, last, stateNames, rollups);
+        rollups = nullptr;
+    }
+    if (engines.useRBTree) {
+        insertRecords(next->rbt, first, last, stateNames, rollups);
+        rollups = nullptr;
+    }
+    if (engines.useFlatIndex) {
+        insertRecords(next->flat, first, last, stateNames, rollups);
+        next->flat.finalize();
+    }
+    next->columns = current->columns;
+    refreshColumns(engines, next->columns, batch);
+    buildNameIndexes(*next, &*current);
+
+    // Keep the cached queries of states the refresh didn't touch
+    unordered_set<string> changedStates;
+    for (const hashTableVars& r : batch.records) {
+        changedStates.emplace(stateNames[r.state]);
+    }
+    next->cache.setCapacity(engines.cacheBytes);
+    next->cache.carryOver(current->cache, changedStates, [&](char engine, string_view state, string_view disease) {
+        return engine == 'h' ? lookup(next->ht, state, disease)
+             : engine == 'r' ? lookup(next->rbt, state, disease)
+                             : lookup(next->flat, state, disease);
+    });
+    engines.versions.publish(std::move(next));
+}
+
+/**
+ * Start loading new rows in the background: the rows appended to the CSV since it was loaded,
+ * or the rows of a delta file.
+ * @param engines The structures to update.
+ * @param deltaPath Delta file to load, or "" for rows appended to the CSV.
+ */
+void startRefresh(Engines &engines, const string &deltaPath) {
+    if (engines.refreshing) {
+        cout << "A refresh is already running.\n\n";
+        return;
+    }
+    if (engines.refresher.joinable()) {
+        engines.refresher.join();
+    }
+    engines.refreshing = true;
+    engines.refresher = thread([&engines, deltaPath] {
+        steady_clock::time_point start = steady_clock::now();
+        RecordBatch batch;
+        string error;
+        bool decoded = deltaPath.empty() ? decodeAppended(engines.csvPath, engines.csvOffset, batch, error)
+                                         : decodeDelta(deltaPath, batch, error);
+        if (decoded) {
+            applyRefresh(engines, batch);
+            long long duration = duration_cast<microseconds>(steady_clock::now() - start).count();
+            cout << "\n[Refresh] Applied " << batch.records.size() << " records from " << batch.lines
+                 << " new lines in " << duration << " microseconds.\n";
+        } else {
+            cout << "\n[Refresh] Failed: " << error << "\n";
+        }
+        engines.refreshing = false;
+    });
+    cout << "Refreshing in the background; queries remain available.\n\n";
+}
+
+/**
+ * Resolve a typed name to the stored one regardless of case, saying so when the case differed.
+ * @param index The names to match against.
+ * @param text The name as typed.
+ * @param kind "state" or "disease", for the message.
+ * @return The stored name, or text unchanged if no name matches.
+ */
+string resolveName(const NameIndex &index, const string &text, const string &kind) {
+    string_view stored = index.match(text);
+    if (stored.empty() || stored == text) {
+        return text;
+    }
+    cout << "Using " << kind << " " << stored << " for " << text << ".\n";
+    return string(stored);
+}
+
+/**
+ * Suggest names for one that wasn't found: names it is a prefix of, then names within two edits.
+ * @param index The names to suggest from.
+ * @param text The name as typed.
+ * @param kind "state" or "disease", for the message.
+ */
+void printSuggestions(const NameIndex &index, const string &text, const string &kind) {
+    if (text.empty()) {
+        return;
+    }
+    vector<string_view> names = index.complete(text, 5);
+    for (string_view name : index.suggest(text, 2, 5)) {
+        if (find(names.begin(), names.end(), name) == names.end()) {
+            names.push_back(name);
+        }
+    }
+    if (names.empty()) {
+        return;
+    }
+    cout << "Did you mean " << kind << " ";
+    for (size_t i = 0; i < names.size(); i++) {
+        cout << (i == 0 ? "" : i + 1 == names.size() ? " or " : ", ") << names[i];
+    }
+    cout << "?\n\n";
 }
 
 /**
  * Process user queries to search for disease data in the selected data structures.
- * @param ht HashTable object to query (if buildHashTable is true).
- * @param rbt RBTree object to query (if buildRBTree is true).
- * @param buildHashTable Boolean indicating whether the Hash Table was built.
- * @param buildRBTree Boolean indicating whether the Red-Black Tree was built.
+ * @param engines The structures that were built.
  */
-void processUserChoice(HashTable &ht, RBTree &rbt, bool buildHashTable, bool buildRBTree) {
+void processUserChoice(Engines &engines) {
     while (true) {
         string userState, userDisease;
-        cout << "Enter a state you would like to look up a disease for (or type 'Exit' to quit): ";
+        cout << "Enter a state you would like to look up a disease for "
+                "(or type 'Range' or 'Stats' for range queries, 'Scan' for a column scan, 'Rollup' for yearly totals, "
+                "'Refresh [FILE]' to load new rows, "
+                "'Exit' to quit): ";
         getline(cin, userState);
         if (userState == "Exit") break;
 
+        if (userState == "Refresh" || userState.rfind("Refresh ", 0) == 0) {
+            startRefresh(engines, userState.size() > 8 ? userState.substr(8) : "");
+            continue;
+        }
+
+        if (userState == "Scan") {
+            processColumnScan(engines.versions);
+            continue;
+        }
+
+        if (userState == "Rollup") {
+            processRollupQuery(engines.versions);
+            continue;
+        }
+
+        if (userState == "Range" || userState == "Stats") {
+            if (engines.useRBTree) {
+                processRangeQuery(engines.versions, userState);
+            } else {
+                cout << "Range queries use the Red-Black Tree; choose option 2, 3 or 5 at startup.\n\n";
+            }
+            continue;
+        }
+
         cout << "Enter the disease/cause of death you want to know about (or type 'Example' for a list): ";
         getline(cin, userDisease);
         if (userDisease == "Example") {
-            cout << "Alcohol\n";
-            cout << "Asthma\n";
-            cout << "Cancer\n";
-            cout << "Chronic Kidney Disease\n";
-            cout << "Chronic Obstructive Pulmonary Disease\n";
-            cout << "Cardiovascular Disease\n";
-            cout << "Overarching Conditions\n";
+            {
+                auto names = engines.versions.read();
+                for (string_view name : names->diseaseNames->complete("", names->diseaseNames->size())) {
+                    cout << name << "\n";
+                }
+            }
             cout << "Please enter your disease you would like to search for: ";
             getline(cin, userDisease);
         }
 
-        if (buildHashTable && buildRBTree) {
-            // Time the query operation for hash table
-            steady_clock::time_point startHT = steady_clock::now();
-            ht.displayDeathCount(userState, userDisease);
-            long long durationHT;
-            tock(startHT, "Hash Table search", durationHT);
-
-            // Time the query operation for red-black tree
-            steady_clock::time_point startRBT = steady_clock::now();
-            rbt.displayDeathCount(userState, userDisease);
-            long long durationRBT;
-            tock(startRBT, "Red-Black Tree search", durationRBT);
-
-            if (durationHT < durationRBT) {
-                cout << "Hash Table was faster in searching by " << abs(durationHT - durationRBT) << " microseconds.\n\n";
-            } else {
-                cout << "Red-Black Tree was faster in searching by " << abs(durationRBT - durationHT) << " microseconds.\n\n";
-            }
+        // Names typed in another case resolve to the stored ones
+        auto version = engines.versions.read();
+        userState = resolveName(*version->stateNames, userState, "state");
+        userDisease = resolveName(*version->diseaseNames, userDisease, "disease");
 
-        } else if (buildHashTable) {
-            // Time the query operation for hash table only
-            steady_clock::time_point startHT = steady_clock::now();
-            ht.displayDeathCount(userState, userDisease);
-            long long durationHT;
-            tock(startHT, "Hash Table search", durationHT);
-        } else if (buildRBTree) {
-            // Time the query operation for red-black tree only
-            steady_clock::time_point startRBT = steady_clock::now();
-            rbt.displayDeathCount(userState, userDisease);
-            long long durationRBT;
-            tock(startRBT, "Red-Black Tree search", durationRBT);
+        // Time the query operation for each selected structure
+        vector<pair<string, long long>> timings;
+        if (engines.useHashTable) {
+            timedSearch(version->ht, 'h', version->cache, "Hash Table", userState, userDisease, timings);
+        }
+        if (engines.useRBTree) {
+            timedSearch(version->rbt, 'r', version->cache, "Red-Black Tree", userState, userDisease, timings);
+        }
+        if (engines.useFlatIndex) {
+            timedSearch(version->flat, 'f', version->cache, "Flat Index", userState, userDisease, timings);
+        }
+        printComparison(timings, "searching");
+
+        uint16_t id;
+        if (!dictionaries().states.find(userState, id)) {
+            printSuggestions(*version->stateNames, userState, "state");
+        } else if (!dictionaries().diseases.find(userDisease, id)) {
+            printSuggestions(*version->diseaseNames, userDisease, "disease");
         }
     }
+    if (engines.refresher.joinable()) {
+        engines.refresher.join();
+    }
 }
 
 /**
  * Main function to execute the program.
+ * - Parses command-line options (--build-snapshot writes a snapshot, --batch runs a query
+ *   file and --serve answers queries over a socket; none of them prompts).
  * - Displays menu.
- * - Builds selected data structures.
+ * - Builds selected data structures from the CSV or a snapshot.
  * - Processes user queries.
  */
-int main() {
-    HashTable ht;
-    RBTree rbt;
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+    if (!options.buildSnapshotPath.empty() || !options.batchPath.empty() || !options.serveAddress.empty()) {
+        int status = !options.buildSnapshotPath.empty() ? buildSnapshot(options)
+                   : !options.batchPath.empty() ? runBatchMode(options)
+                   : runServerMode(options);
+        if (options.dumpStats) {
+            dumpStats(cerr);
+        }
+        return status;
+    }
+
+    Engines engines;
+    engines.cacheBytes = options.cacheBytes;
 
     // Display menu and process user's choice for data structure
     int choice = getUserChoice();
 
-    bool buildHashTable = (choice == 1 || choice == 3);
-    bool buildRBTree = (choice == 2 || choice == 3);
+    engines.useHashTable = (choice == 1 || choice == 3 || choice == 5);
+    engines.useRBTree = (choice == 2 || choice == 3 || choice == 5);
+    engines.useFlatIndex = (choice == 4 || choice == 5);
 
-    long long buildTimeHT = 0;
-    long long buildTimeRBT = 0;
-
-    // Build the selected data structures
-    buildDataStructures(ht, rbt, buildHashTable, buildRBTree, buildTimeHT, buildTimeRBT);
-
-    // Display build times and differences if both structures are built
-    if (buildHashTable && buildRBTree) {
-        cout << "Build time for Hash Table: " << buildTimeHT << " microseconds" << endl;
-        cout << "Build time for Red-Black Tree: " << buildTimeRBT << " microseconds" << endl;
+    // Load the records and build the selected data structures
+    vector<RecordBatch> batches;
+    engines.csvPath = options.streamPath.empty() ? options.csvPath : options.streamPath;
+    bool loaded = loadRecords(options, batches, engines.csvOffset);
+    if (loaded) {
+        buildDataStructures(engines, batches);
+    }
 
-        if (buildTimeHT < buildTimeRBT) {
-            cout << "Hash Table was faster in building by " << abs(buildTimeHT - buildTimeRBT) <<  " microseconds\n\n";
-        } else {
-            cout << "Red-Black Tree was faster in building by " << abs(buildTimeRBT - buildTimeHT) <<  " microseconds\n\n";
+    // Display build times and differences if more than one structure is built
+    vector<pair<string, long long>> buildTimes;
+    if (engines.useHashTable) {
+        buildTimes.emplace_back("Hash Table", engines.buildTimeHT);
+    }
+    if (engines.useRBTree) {
+        buildTimes.emplace_back("Red-Black Tree", engines.buildTimeRBT);
+    }
+    if (engines.useFlatIndex) {
+        buildTimes.emplace_back("Flat Index", engines.buildTimeFlat);
+    }
+    if (buildTimes.size() > 1) {
+        for (const auto& entry : buildTimes) {
+            cout << "Build time for " << entry.first << ": " << entry.second << " microseconds" << endl;
         }
+        printComparison(buildTimes, "building");
     }
 
     // Process user queries
-    processUserChoice(ht, rbt, buildHashTable, buildRBTree);
+    processUserChoice(engines);
 
+    if (options.dumpStats) {
+        dumpStats(cerr);
+    }
     return 0;
 }
-
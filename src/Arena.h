@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "Stats.h"
+
+using namespace std;
+
+// Pool that carves objects of one type out of fixed-size blocks. An object destroyed on its
+// own leaves its slot on a free list for the next create(), so churn doesn't grow the pool;
+// clear() destroys everything left and releases the blocks in one pass, without recursion.
+template <typename T, size_t BlockSize = 64>
+class ObjectPool {
+private:
+    // Raw, suitably aligned storage for BlockSize objects.
+    struct Block {
+        alignas(T) unsigned char storage[BlockSize * sizeof(T)];
+    };
+
+    vector<unique_ptr<Block>> blocks; // Allocated blocks; only the last one may be partly used.
+    size_t usedInLast;                // Number of slots handed out from the last block.
+    vector<T*> freeSlots;             // Slots of destroyed objects, reused first.
+    size_t live;                      // Number of objects currently constructed.
+
+    T* slot(size_t block, size_t index) {
+        return reinterpret_cast<T*>(blocks[block]->storage) + index;
+    }
+
+public:
+    ObjectPool() : usedInLast(BlockSize), live(0) {}
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // Moving hands over the blocks; objects stay where they are, so pointers to them remain valid.
+    ObjectPool(ObjectPool&& other) noexcept : ObjectPool() {
+        swap(other);
+    }
+
+    ObjectPool& operator=(ObjectPool&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~ObjectPool() {
+        clear();
+    }
+
+    /**
+     * Construct a new object in the pool.
+     * @param args Constructor arguments.
+     * @return Pointer to the object, valid until the pool is cleared or destroyed.
+     */
+    template <typename... Args>
+    T* create(Args&&... args) {
+        if (!freeSlots.empty()) {
+            T* object = new (freeSlots.back()) T(std::forward<Args>(args)...);
+            freeSlots.pop_back();
+            live++;
+            STATS_COUNT(poolObjects);
+            return object;
+        }
+        if (usedInLast == BlockSize) {
+            blocks.push_back(make_unique<Block>());
+            STATS_COUNT(poolBlocks);
+            usedInLast = 0;
+        }
+        T* object = new (slot(blocks.size() - 1, usedInLast)) T(std::forward<Args>(args)...);
+        usedInLast++;
+        live++;
+        STATS_COUNT(poolObjects);
+        return object;
+    }
+
+    /**
+     * Destroy one object and keep its slot for reuse.
+     * @param object An object created by this pool and not destroyed yet.
+     */
+    void destroy(T* object) {
+        object->~T();
+        freeSlots.push_back(object);
+        live--;
+    }
+
+    /**
+     * Destroy every object and release all blocks.
+     */
+    void clear() {
+        sort(freeSlots.begin(), freeSlots.end());
+        for (size_t b = 0; b < blocks.size(); b++) {
+            size_t count = (b + 1 == blocks.size()) ? usedInLast : BlockSize;
+            for (size_t i = 0; i < count; i++) {
+                T* object = slot(b, i);
+                if (!binary_search(freeSlots.begin(), freeSlots.end(), object)) {
+                    object->~T();
+                }
+            }
+        }
+        blocks.clear();
+        freeSlots.clear();
+        usedInLast = BlockSize;
+        live = 0;
+    }
+
+    /**
+     * Exchange contents with another pool.
+     */
+    void swap(ObjectPool& other) noexcept {
+        blocks.swap(other.blocks);
+        freeSlots.swap(other.freeSlots);
+        std::swap(usedInLast, other.usedInLast);
+        std::swap(live, other.live);
+    }
+
+    // Number of live objects.
+    size_t size() const { return live; }
+
+    // Number of blocks currently allocated.
+    size_t blockCount() const { return blocks.size(); }
+};
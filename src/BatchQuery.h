@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Dictionary.h"
+#include "Parallel.h"
+#include "QueryResult.h"
+#include "ResultCache.h"
+#include "StateRecords.h"
+
+using namespace std;
+
+// One (state, disease) lookup read from a query file.
+struct BatchQuery {
+    string state;
+    string disease;
+};
+
+// Outcome of one lookup, kept so results can be written after timing is done.
+struct BatchResult {
+    QueryResult result;  // The matching records.
+    size_t matches = 0;  // Number of matching records.
+    long long nanos = 0; // Lookup latency in nanoseconds.
+};
+
+// Throughput and latency of one structure over a batch.
+struct BatchSummary {
+    size_t queries = 0;      // Queries executed.
+    long long wallNanos = 0; // Wall-clock time for the whole batch.
+    long long p50Nanos = 0;  // Median lookup latency.
+    long long p99Nanos = 0;  // 99th percentile lookup latency.
+
+    // Queries per second over the wall-clock time.
+    double queriesPerSecond() const { return wallNanos == 0 ? 0.0 : queries * 1e9 / wallNanos; }
+};
+
+/**
+ * Split a query line, "state<TAB>disease" or "state,disease", into its two parts.
+ * @param line The line, without its newline.
+ * @param state Receives the state.
+ * @param disease Receives the disease.
+ * @return False if either part is missing.
+ */
+inline bool splitQueryLine(string_view line, string_view& state, string_view& disease) {
+    // State names have no commas, so the first separator splits state from disease
+    size_t split = line.find('\t');
+    if (split == string_view::npos) {
+        split = line.find(',');
+    }
+    if (split == string_view::npos || split == 0 || split + 1 == line.size()) {
+        return false;
+    }
+    state = line.substr(0, split);
+    disease = line.substr(split + 1);
+    return true;
+}
+
+/**
+ * Read queries, one per line, as "state<TAB>disease" or "state,disease".
+ * Blank lines and lines starting with '#' are skipped.
+ * @param in Stream to read.
+ * @param queries Receives the queries.
+ * @return The number of malformed lines that were skipped.
+ */
+inline size_t readBatchQueries(istream& in, vector<BatchQuery>& queries) {
+    size_t malformed = 0;
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        string_view state, disease;
+        if (!splitQueryLine(line, state, disease)) {
+            malformed++;
+            continue;
+        }
+        queries.push_back({string(state), string(disease)});
+    }
+    return malformed;
+}
+
+/**
+ * Run every query against a read-only structure on a pool of worker threads.
+ * Workers claim small runs of queries from a shared counter, so slow lookups don't leave
+ * threads idle.
+ * @param structure Any structure with find(state) returning const StateRecords*.
+ * @param queries The queries to run.
+ * @param threads Number of worker threads.
+ * @param results Receives one result per query, in query order.
+ * @param cache Result cache to answer repeated queries from, or nullptr.
+ * @param engine Cache tag of the structure.
+ * @return Throughput and latency percentiles.
+ */
+template <typename Structure>
+BatchSummary runBatch(const Structure& structure, const vector<BatchQuery>& queries, size_t threads,
+                      vector<BatchResult>& results, ResultCache* cache = nullptr, char engine = 0) {
+    using namespace std::chrono;
+    constexpr size_t claimSize = 64;
+
+    results.assign(queries.size(), BatchResult());
+    atomic<size_t> next(0);
+
+    steady_clock::time_point start = steady_clock::now();
+    parallelFor(max<size_t>(1, threads), [&](size_t) {
+        size_t first;
+        while ((first = next.fetch_add(claimSize)) < queries.size()) {
+            size_t last = min(first + claimSize, queries.size());
+            for (size_t i = first; i < last; i++) {
+                BatchResult& batchResult = results[i];
+                steady_clock::time_point begin = steady_clock::now();
+                if (cache != nullptr) {
+                    batchResult.result = cache->lookup(structure, engine, queries[i].state, queries[i].disease,
+                                                       batchResult.matches);
+                } else {
+                    batchResult.result = lookup(structure, queries[i].state, queries[i].disease);
+                    batchResult.matches = batchResult.result.size();
+                }
+                batchResult.nanos = duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+            }
+        }
+    });
+
+    BatchSummary summary;
+    summary.queries = queries.size();
+    summary.wallNanos = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    if (!results.empty()) {
+        vector<long long> latencies;
+        latencies.reserve(results.size());
+        for (const BatchResult& batchResult : results) {
+            latencies.push_back(batchResult.nanos);
+        }
+        auto percentile = [&](double p) {
+            size_t rank = min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+            nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+            return latencies[rank];
+        };
+        summary.p50Nanos = percentile(0.50);
+        summary.p99Nanos = percentile(0.99);
+    }
+    return summary;
+}
+
+/**
+ * Write a CSV field, quoting it if it contains a separator, quote or newline.
+ */
+inline void writeCSVField(OutputBuffer& out, string_view text) {
+    if (text.find_first_of(",\"\n") == string_view::npos) {
+        out << text;
+        return;
+    }
+    out << '"';
+    for (char c : text) {
+        if (c == '"') {
+            out << '"';
+        }
+        out << c;
+    }
+    out << '"';
+}
+
+/**
+ * Write a JSON string literal.
+ */
+inline void writeJSONString(OutputBuffer& out, string_view text) {
+    out << '"';
+    for (char c : text) {
+        switch (c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            case '\r': out << "\\r"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    const char* hex = "0123456789abcdef";
+                    out << "\\u00" << hex[(c >> 4) & 0xF] << hex[c & 0xF];
+                } else {
+                    out << c;
+                }
+        }
+    }
+    out << '"';
+}
+
+/**
+ * Write batch results, one line per matching record and one line per query without matches.
+ * Status is "ok", "state_not_found" or "disease_not_found".
+ * CSV columns: structure,query,state,disease,status,year,death_count,mortality.
+ * @param out Output stage to append to.
+ * @param structureName Name of the structure the results came from.
+ * @param queries The queries that were run.
+ * @param results Their results.
+ * @param json Write JSON lines instead of CSV.
+ */
+inline void writeBatchResults(OutputBuffer& out, const string& structureName, const vector<BatchQuery>& queries,
+                              const vector<BatchResult>& results, bool json) {
+    const Dictionary& mortality = dictionaries().mortality;
+
+    auto writeLine = [&](size_t i, const char* status, const hashTableVars* entry) {
+        if (json) {
+            out << "{\"structure\":";
+            writeJSONString(out, structureName);
+            out << ",\"query\":" << i << ",\"state\":";
+            writeJSONString(out, queries[i].state);
+            out << ",\"disease\":";
+            writeJSONString(out, queries[i].disease);
+            out << ",\"status\":\"" << string_view(status) << '"';
+            if (entry != nullptr) {
+                out << ",\"year\":" << static_cast<int>(entry->year)
+                    << ",\"death_count\":" << static_cast<int>(entry->deathCount) << ",\"mortality\":";
+                writeJSONString(out, mortality.name(entry->isMortality));
+            }
+            out << "}\n";
+            return;
+        }
+        writeCSVField(out, structureName);
+        out << ',' << i << ',';
+        writeCSVField(out, queries[i].state);
+        out << ',';
+        writeCSVField(out, queries[i].disease);
+        out << ',' << string_view(status) << ',';
+        if (entry != nullptr) {
+            out << static_cast<int>(entry->year) << ',' << static_cast<int>(entry->deathCount) << ',';
+            writeCSVField(out, mortality.name(entry->isMortality));
+        } else {
+            out << ",,";
+        }
+        out << '\n';
+    };
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const BatchResult& batchResult = results[i];
+        if (!batchResult.result.stateFound()) {
+            writeLine(i, "state_not_found", nullptr);
+        } else if (batchResult.matches == 0) {
+            writeLine(i, "disease_not_found", nullptr);
+        } else {
+            batchResult.result.forEach([&](const hashTableVars& entry) {
+                writeLine(i, "ok", &entry);
+            });
+        }
+    }
+}
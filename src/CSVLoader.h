@@ -0,0 +1,265 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <fstream>
+
+#if defined(_WIN32)
+#define CSV_LOADER_NO_MMAP
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CSV_LOADER_SSE2
+#endif
+
+using namespace std;
+
+// Read-only view of a whole file, memory-mapped where the platform supports it.
+class MappedFile {
+private:
+    const char* bytes; // First byte of the file contents.
+    size_t length;     // Size of the file in bytes.
+#ifdef CSV_LOADER_NO_MMAP
+    vector<char> buffer; // Fallback storage when mmap is unavailable.
+#endif
+
+public:
+    /**
+     * Map the file at the given path into memory.
+     * @param path Path of the file to open.
+     */
+    explicit MappedFile(const string& path) : bytes(nullptr), length(0) {
+#ifdef CSV_LOADER_NO_MMAP
+        ifstream file(path, ios::binary | ios::ate);
+        if (!file.is_open()) {
+            return;
+        }
+        buffer.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(buffer.data(), buffer.size());
+        bytes = buffer.data();
+        length = buffer.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                ::madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                bytes = static_cast<const char*>(mapped);
+                length = static_cast<size_t>(info.st_size);
+            }
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef CSV_LOADER_NO_MMAP
+        if (bytes != nullptr) {
+            ::munmap(const_cast<char*>(bytes), length);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const { return bytes != nullptr; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// One parsed CSV row. The string views point into the mapped file.
+struct CSVRow {
+    int year;                 // Year of the record.
+    string_view state;        // State name.
+    string_view disease;      // Disease or cause of death.
+    string_view isMortality;  // Data value type, as written in the file.
+    int deathCount;           // Number of deaths reported.
+};
+
+/**
+ * Find the next field delimiter (',' or '\n') at or after p.
+ * Scans 16 bytes at a time with SSE2 when available.
+ * @param p Start of the scan.
+ * @param end One past the last byte that may be scanned.
+ * @return Pointer to the delimiter, or end if none was found.
+ */
+inline const char* findDelimiter(const char* p, const char* end) {
+#ifdef CSV_LOADER_SSE2
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, comma),
+                                                  _mm_cmpeq_epi8(chunk, newline)));
+        if (mask != 0) {
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != ',' && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Parse a base-10 integer field in place, tolerating surrounding blanks and '\r' the way stoi does.
+ * @param field The field text.
+ * @param value Receives the parsed value.
+ * @return True if a number was found.
+ */
+inline bool parseIntField(string_view field, int& value) {
+    const char* first = field.data();
+    const char* last = first + field.size();
+    while (first < last && (*first == ' ' || *first == '\t')) {
+        first++;
+    }
+    if (first < last && *first == '+') {
+        first++;
+    }
+    return from_chars(first, last, value).ec == errc();
+}
+
+/**
+ * Split one line into the five columns used by the program.
+ * @param p Start of the line.
+ * @param end End of the mapped data.
+ * @param row Receives the parsed fields.
+ * @param next Receives the start of the following line.
+ * @return True if the line had a valid year and death count.
+ */
+inline bool parseCSVLine(const char* p, const char* end, CSVRow& row, const char*& next) {
+    string_view fields[5];
+    int fieldCount = 0;
+    const char* fieldStart = p;
+    while (true) {
+        const char* d = findDelimiter(fieldStart, end);
+        if (fieldCount < 5) {
+            fields[fieldCount] = string_view(fieldStart, d - fieldStart);
+        }
+        fieldCount++;
+        if (d == end || *d == '\n') {
+            next = (d == end) ? end : d + 1;
+            break;
+        }
+        fieldStart = d + 1;
+    }
+
+    if (fieldCount < 5) {
+        return false;
+    }
+    row.state = fields[1];
+    row.disease = fields[2];
+    row.isMortality = fields[3];
+    return parseIntField(fields[0], row.year) && parseIntField(fields[4], row.deathCount);
+}
+
+/**
+ * Call fn for every well-formed row in [begin, end).
+ * @param begin First byte of the first line to parse.
+ * @param end One past the last byte.
+ * @param fn Callback receiving a const CSVRow&.
+ * @return Number of lines visited.
+ */
+template <typename Fn>
+size_t forEachCSVRow(const char* begin, const char* end, Fn&& fn) {
+    size_t lines = 0;
+    CSVRow row;
+    const char* p = begin;
+    while (p < end) {
+        const char* next;
+        if (parseCSVLine(p, end, row, next)) {
+            fn(row);
+        }
+        lines++;
+        p = next;
+    }
+    return lines;
+}
+
+/**
+ * Skip the header line of a mapped CSV file.
+ * @param file The mapped file.
+ * @return Pointer to the first data line.
+ */
+inline const char* skipHeader(const MappedFile& file) {
+    const char* end = file.data() + file.size();
+    const char* nl = static_cast<const char*>(memchr(file.data(), '\n', file.size()));
+    return nl == nullptr ? end : nl + 1;
+}
+
+/**
+ * Find the end of the last complete line, so a file that is still being appended to is only
+ * read up to its last newline.
+ * @param begin First byte.
+ * @param end One past the last byte.
+ * @return One past the last '\n' in [begin, end), or begin if there is none.
+ */
+inline const char* lastLineEnd(const char* begin, const char* end) {
+    for (const char* p = end; p > begin; p--) {
+        if (p[-1] == '\n') {
+            return p;
+        }
+    }
+    return begin;
+}
+
+/**
+ * Lowercase a mortality label into a reusable buffer and report whether it is a mortality record.
+ * @param label The raw label from the file.
+ * @param lowered Buffer that receives the lowercase label.
+ * @return True if the label contains "mortality".
+ */
+inline bool lowerMortality(string_view label, string& lowered) {
+    lowered.assign(label.data(), label.size());
+    for (char& ch : lowered) {
+        if (ch >= 'A' && ch <= 'Z') {
+            ch = static_cast<char>(ch - 'A' + 'a');
+        }
+    }
+    return lowered.find("mortality") != string::npos;
+}
+
+/**
+ * Split [begin, end) into at most parts byte ranges that each start at the beginning of a line.
+ * @param begin First byte of the first line.
+ * @param end One past the last byte.
+ * @param parts Desired number of ranges.
+ * @return The ranges, in file order.
+ */
+inline vector<pair<const char*, const char*>> splitLines(const char* begin, const char* end, size_t parts) {
+    vector<pair<const char*, const char*>> ranges;
+    size_t total = static_cast<size_t>(end - begin);
+    const char* start = begin;
+    for (size_t i = 1; i <= parts && start < end; i++) {
+        const char* stop = (i == parts) ? end : begin + total / parts * i;
+        if (stop <= start) {
+            continue;
+        }
+        if (stop < end) {
+            const char* nl = static_cast<const char*>(memchr(stop - 1, '\n', end - stop + 1));
+            stop = (nl == nullptr) ? end : nl + 1;
+        }
+        ranges.emplace_back(start, stop);
+        start = stop;
+    }
+    return ranges;
+}
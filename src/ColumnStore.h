@@ -0,0 +1,364 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "StateRecords.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COLUMN_STORE_SSE2
+#endif
+
+#if defined(COLUMN_STORE_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define COLUMN_STORE_AVX2
+#endif
+
+using namespace std;
+
+// Which rows a column scan selects.
+struct ColumnFilter {
+    uint16_t disease = 0;     // Disease id to match.
+    uint16_t fromYear = 0;    // First year of the window.
+    uint16_t toYear = 0;      // Last year of the window.
+    bool anyState = true;     // Match every state, or only state.
+    uint16_t state = 0;       // State id to match when !anyState.
+};
+
+// Implementation of the filter and aggregate loop.
+enum class ColumnKernel { scalar, sse2, avx2, best };
+
+// Deduplicated records stored column by column (year, state, disease, mortality, death
+// count in separate contiguous arrays), for full scans that filter on a few columns and
+// aggregate one. The scan kernels evaluate the predicate on 8 (SSE2) or 16 (AVX2) rows at a
+// time, so a scan streams through memory instead of visiting records one by one.
+// Rows are stored in fixed-size chunks that copies of the store share until one of them
+// changes a chunk (copy-on-write), so a new engine version copies only the chunks a refresh
+// appends to or updates.
+class ColumnStore {
+private:
+    static constexpr size_t chunkRows = 4096; // Rows per chunk; a multiple of every kernel's step.
+
+    struct Chunk {
+        uint16_t years[chunkRows];       // Year of each row.
+        uint16_t states[chunkRows];      // State id of each row.
+        uint16_t diseases[chunkRows];    // Disease id of each row.
+        uint8_t mortality[chunkRows];    // Mortality label id of each row.
+        int32_t deathCounts[chunkRows];  // Death count of each row.
+    };
+
+    vector<shared_ptr<Chunk>> chunks; // Full chunks, then the partly filled last one.
+    size_t rows = 0;                  // Number of rows.
+
+    /**
+     * The chunk holding a row, copied first if another store still shares it.
+     */
+    Chunk& ownChunk(size_t row) {
+        shared_ptr<Chunk>& chunk = chunks[row / chunkRows];
+        if (chunk.use_count() > 1) {
+            chunk = make_shared<Chunk>(*chunk);
+        } else {
+            // Pairs with the release of the last other owner, whose reads must finish before we write
+            atomic_thread_fence(memory_order_acquire);
+        }
+        return *chunk;
+    }
+
+    /**
+     * Scalar scan of rows [first, used) of a chunk.
+     */
+    static void scanScalar(const Chunk& chunk, size_t first, size_t used, const ColumnFilter& filter,
+                           DeathAggregate& result) {
+        const uint16_t* years = chunk.years;
+        const uint16_t* states = chunk.states;
+        const uint16_t* diseases = chunk.diseases;
+        const int32_t* deathCounts = chunk.deathCounts;
+        for (size_t i = first; i < used; i++) {
+            if (diseases[i] == filter.disease && years[i] >= filter.fromYear && years[i] <= filter.toYear &&
+                (filter.anyState || states[i] == filter.state)) {
+                result.add(deathCounts[i]);
+            }
+        }
+    }
+
+#ifdef COLUMN_STORE_SSE2
+    /**
+     * SSE2 scan of the first used rows of a chunk, 8 rows per step.
+     * @return The first row left for the scalar tail.
+     */
+    static size_t scanSSE2(const Chunk& chunk, size_t used, const ColumnFilter& filter, DeathAggregate& result) {
+        const uint16_t* years = chunk.years;
+        const uint16_t* states = chunk.states;
+        const uint16_t* diseases = chunk.diseases;
+        const int32_t* deathCounts = chunk.deathCounts;
+        // Unsigned 16-bit compares done as signed compares on values with the top bit flipped
+        const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+        const __m128i disease = _mm_set1_epi16(static_cast<short>(filter.disease));
+        const __m128i state = _mm_set1_epi16(static_cast<short>(filter.state));
+        const __m128i below = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(filter.fromYear - 1)), flip);
+        const __m128i above = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(filter.toYear + 1)), flip);
+        const __m128i anyState = filter.anyState ? _mm_set1_epi16(-1) : _mm_setzero_si128();
+        const bool openLow = filter.fromYear == 0;
+        const bool openHigh = filter.toYear == 0xFFFF;
+
+        __m128i sumLo = _mm_setzero_si128(), sumHi = _mm_setzero_si128(); // Two int64 lanes each.
+        __m128i best = _mm_set1_epi32(INT_MIN);
+        long long count = 0;
+
+        size_t i = 0;
+        for (; i + 8 <= used; i += 8) {
+            __m128i year = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&years[i])), flip);
+            __m128i mask = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&diseases[i])), disease);
+            if (!openLow) {
+                mask = _mm_and_si128(mask, _mm_cmpgt_epi16(year, below));
+            }
+            if (!openHigh) {
+                mask = _mm_and_si128(mask, _mm_cmplt_epi16(year, above));
+            }
+            mask = _mm_and_si128(mask, _mm_or_si128(anyState,
+                _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&states[i])), state)));
+            int bits = _mm_movemask_epi8(mask);
+            if (bits == 0) {
+                continue;
+            }
+            count += __builtin_popcount(static_cast<unsigned>(bits)) / 2;
+
+            for (int half = 0; half < 2; half++) {
+                __m128i lanes = half == 0 ? _mm_unpacklo_epi16(mask, mask) : _mm_unpackhi_epi16(mask, mask);
+                __m128i deaths = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&deathCounts[i + 4 * half]));
+                __m128i selected = _mm_and_si128(deaths, lanes);
+                // Sign-extend to 64 bits before summing so large totals can't overflow
+                __m128i sign = _mm_srai_epi32(selected, 31);
+                sumLo = _mm_add_epi64(sumLo, _mm_unpacklo_epi32(selected, sign));
+                sumHi = _mm_add_epi64(sumHi, _mm_unpackhi_epi32(selected, sign));
+                // max without SSE4.1: unselected lanes become INT_MIN, then compare and blend
+                __m128i candidate = _mm_or_si128(selected, _mm_andnot_si128(lanes, _mm_set1_epi32(INT_MIN)));
+                __m128i greater = _mm_cmpgt_epi32(candidate, best);
+                best = _mm_or_si128(_mm_and_si128(greater, candidate), _mm_andnot_si128(greater, best));
+            }
+        }
+
+        long long sums[4];
+        int32_t maxes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), sumLo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + 2), sumHi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(maxes), best);
+        DeathAggregate partial;
+        partial.count = count;
+        partial.sum = sums[0] + sums[1] + sums[2] + sums[3];
+        partial.max = INT_MIN;
+        for (int32_t m : maxes) {
+            partial.max = m > partial.max ? m : partial.max;
+        }
+        result.add(partial);
+        return i;
+    }
+#endif
+
+#ifdef COLUMN_STORE_AVX2
+    /**
+     * AVX2 scan of the first used rows of a chunk, 16 rows per step. Compiled for AVX2
+     * regardless of the build flags and only called when the CPU supports it.
+     * @return The first row left for the scalar tail.
+     */
+    __attribute__((target("avx2")))
+    static size_t scanAVX2(const Chunk& chunk, size_t used, const ColumnFilter& filter, DeathAggregate& result) {
+        const uint16_t* years = chunk.years;
+        const uint16_t* states = chunk.states;
+        const uint16_t* diseases = chunk.diseases;
+        const int32_t* deathCounts = chunk.deathCounts;
+        const __m256i flip = _mm256_set1_epi16(static_cast<short>(0x8000));
+        const __m256i disease = _mm256_set1_epi16(static_cast<short>(filter.disease));
+        const __m256i state = _mm256_set1_epi16(static_cast<short>(filter.state));
+        const __m256i below = _mm256_xor_si256(_mm256_set1_epi16(static_cast<short>(filter.fromYear - 1)), flip);
+        const __m256i above = _mm256_xor_si256(_mm256_set1_epi16(static_cast<short>(filter.toYear + 1)), flip);
+        const __m256i anyState = filter.anyState ? _mm256_set1_epi16(-1) : _mm256_setzero_si256();
+        const bool openLow = filter.fromYear == 0;
+        const bool openHigh = filter.toYear == 0xFFFF;
+
+        __m256i sum = _mm256_setzero_si256(); // Four int64 lanes.
+        __m256i best = _mm256_set1_epi32(INT_MIN);
+        long long count = 0;
+
+        size_t i = 0;
+        for (; i + 16 <= used; i += 16) {
+            __m256i year = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&years[i])), flip);
+            __m256i mask = _mm256_cmpeq_epi16(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&diseases[i])), disease);
+            if (!openLow) {
+                mask = _mm256_and_si256(mask, _mm256_cmpgt_epi16(year, below));
+            }
+            if (!openHigh) {
+                mask = _mm256_and_si256(mask, _mm256_cmpgt_epi16(above, year));
+            }
+            mask = _mm256_and_si256(mask, _mm256_or_si256(anyState,
+                _mm256_cmpeq_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&states[i])), state)));
+            unsigned bits = static_cast<unsigned>(_mm256_movemask_epi8(mask));
+            if (bits == 0) {
+                continue;
+            }
+            count += __builtin_popcount(bits) / 2;
+
+            for (int half = 0; half < 2; half++) {
+                __m256i lanes = _mm256_cvtepi16_epi32(half == 0 ? _mm256_castsi256_si128(mask)
+                                                                 : _mm256_extracti128_si256(mask, 1));
+                __m256i deaths = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&deathCounts[i + 8 * half]));
+                __m256i selected = _mm256_and_si256(deaths, lanes);
+                sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(selected)));
+                sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(selected, 1)));
+                best = _mm256_max_epi32(best, _mm256_blendv_epi8(_mm256_set1_epi32(INT_MIN), deaths, lanes));
+            }
+        }
+
+        long long sums[4];
+        int32_t maxes[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), sum);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(maxes), best);
+        DeathAggregate partial;
+        partial.count = count;
+        partial.sum = sums[0] + sums[1] + sums[2] + sums[3];
+        partial.max = INT_MIN;
+        for (int32_t m : maxes) {
+            partial.max = m > partial.max ? m : partial.max;
+        }
+        result.add(partial);
+        return i;
+    }
+#endif
+
+public:
+    /**
+     * Append one record.
+     * @param record The record.
+     */
+    void append(const hashTableVars& record) {
+        if (rows % chunkRows == 0) {
+            chunks.push_back(make_shared<Chunk>());
+        }
+        Chunk& chunk = ownChunk(rows);
+        size_t i = rows % chunkRows;
+        chunk.years[i] = record.year;
+        chunk.states[i] = record.state;
+        chunk.diseases[i] = record.disease;
+        chunk.mortality[i] = record.isMortality;
+        chunk.deathCounts[i] = record.deathCount;
+        rows++;
+    }
+
+    /**
+     * Change the death count of one row.
+     * @param row The row, below size().
+     * @param deathCount The new death count.
+     */
+    void setDeathCount(size_t row, int32_t deathCount) {
+        ownChunk(row).deathCounts[row % chunkRows] = deathCount;
+    }
+
+    /**
+     * The record stored in one row.
+     * @param index The row, below size().
+     */
+    hashTableVars row(size_t index) const {
+        const Chunk& chunk = *chunks[index / chunkRows];
+        size_t i = index % chunkRows;
+        return hashTableVars(chunk.states[i], chunk.diseases[i], chunk.years[i], chunk.deathCounts[i],
+                             chunk.mortality[i]);
+    }
+
+    /**
+     * Replace the contents with every record of a built structure.
+     * @param structure Any structure with forEach(state, records).
+     */
+    template <typename Structure>
+    void build(const Structure& structure) {
+        clear();
+        structure.forEach([&](const string&, const StateRecords& records) {
+            for (const hashTableVars& record : records) {
+                append(record);
+            }
+        });
+    }
+
+    // Remove every row.
+    void clear() {
+        chunks.clear();
+        rows = 0;
+    }
+
+    // Number of rows.
+    size_t size() const { return rows; }
+
+    // Bytes a full scan reads (the four filtered or aggregated columns).
+    size_t scanBytes() const {
+        return size() * (3 * sizeof(uint16_t) + sizeof(int32_t));
+    }
+
+    /**
+     * The kernel that ColumnKernel::best runs on this machine.
+     */
+    static ColumnKernel bestKernel() {
+#ifdef COLUMN_STORE_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            return ColumnKernel::avx2;
+        }
+#endif
+#ifdef COLUMN_STORE_SSE2
+        return ColumnKernel::sse2;
+#else
+        return ColumnKernel::scalar;
+#endif
+    }
+
+    /**
+     * Name of a kernel, for reports.
+     */
+    static const char* kernelName(ColumnKernel kernel) {
+        switch (kernel) {
+            case ColumnKernel::avx2: return "AVX2";
+            case ColumnKernel::sse2: return "SSE2";
+            case ColumnKernel::scalar: return "scalar";
+            default: return kernelName(bestKernel());
+        }
+    }
+
+    /**
+     * Sum, maximum and count of the death counts of every row matching a filter.
+     * @param filter The rows to select.
+     * @param kernel Implementation to use; a kernel the build or CPU lacks falls back to scalar.
+     * @return The aggregate over the matching rows.
+     */
+    DeathAggregate aggregate(const ColumnFilter& filter, ColumnKernel kernel = ColumnKernel::best) const {
+        if (kernel == ColumnKernel::best) {
+            kernel = bestKernel();
+        }
+#ifdef COLUMN_STORE_AVX2
+        if (kernel == ColumnKernel::avx2 && !__builtin_cpu_supports("avx2")) {
+            kernel = ColumnKernel::scalar;
+        }
+#endif
+        DeathAggregate result;
+        for (size_t c = 0; c < chunks.size(); c++) {
+            const Chunk& chunk = *chunks[c];
+            size_t used = min(chunkRows, rows - c * chunkRows);
+            size_t tail = 0;
+#ifdef COLUMN_STORE_AVX2
+            if (kernel == ColumnKernel::avx2) {
+                tail = scanAVX2(chunk, used, filter, result);
+            }
+#endif
+#ifdef COLUMN_STORE_SSE2
+            if (kernel == ColumnKernel::sse2) {
+                tail = scanSSE2(chunk, used, filter, result);
+            }
+#endif
+            scanScalar(chunk, tail, used, filter, result);
+        }
+        return result;
+    }
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Maps the distinct values of one column (states, diseases, mortality labels) to small integer ids.
+// Ids are handed out densely from 0 in the order names are first interned. Safe to use from
+// several threads; lookups take a shared lock.
+class Dictionary {
+private:
+    mutable shared_mutex lock;                // Guards names and ids.
+    deque<string> names;                      // Interned names by id; a deque keeps them in place.
+    unordered_map<string_view, uint16_t> ids; // Name -> id; keys point into names.
+    size_t capacity;                          // Largest number of ids this dictionary may hand out.
+
+public:
+    /**
+     * Create an empty dictionary.
+     * @param maxIds Largest number of distinct names (at most 65536).
+     */
+    explicit Dictionary(size_t maxIds = 65536) : capacity(maxIds) {}
+
+    Dictionary(const Dictionary&) = delete;
+    Dictionary& operator=(const Dictionary&) = delete;
+
+    /**
+     * Get the id of a name, adding it if it has not been seen before.
+     * @param name The name to intern.
+     * @return The id of the name.
+     */
+    uint16_t intern(string_view name) {
+        {
+            shared_lock<shared_mutex> reader(lock);
+            auto it = ids.find(name);
+            if (it != ids.end()) {
+                return it->second;
+            }
+        }
+        unique_lock<shared_mutex> writer(lock);
+        auto it = ids.find(name);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        if (names.size() >= capacity) {
+            throw length_error("Dictionary: too many distinct values");
+        }
+        names.emplace_back(name);
+        uint16_t id = static_cast<uint16_t>(names.size() - 1);
+        ids.emplace(names.back(), id);
+        return id;
+    }
+
+    /**
+     * Look up the id of a name without adding it.
+     * @param name The name to look up.
+     * @param id Receives the id if the name is known.
+     * @return True if the name is known.
+     */
+    bool find(string_view name, uint16_t& id) const {
+        shared_lock<shared_mutex> reader(lock);
+        auto it = ids.find(name);
+        if (it == ids.end()) {
+            return false;
+        }
+        id = it->second;
+        return true;
+    }
+
+    /**
+     * Get the name of an id. The reference stays valid for the life of the dictionary.
+     * @param id An id returned by intern.
+     * @return The interned name.
+     */
+    const string& name(uint16_t id) const {
+        shared_lock<shared_mutex> reader(lock);
+        return names[id];
+    }
+
+    /**
+     * Copy out views of all names, indexed by id, for lookups in a hot loop.
+     * @return The names by id.
+     */
+    vector<string_view> snapshot() const {
+        shared_lock<shared_mutex> reader(lock);
+        return vector<string_view>(names.begin(), names.end());
+    }
+
+    // Number of interned names.
+    size_t size() const {
+        shared_lock<shared_mutex> reader(lock);
+        return names.size();
+    }
+};
+
+// The dictionaries for the three text columns of the dataset.
+struct Dictionaries {
+    Dictionary states;           // State names.
+    Dictionary diseases;         // Disease / cause-of-death names.
+    Dictionary mortality{256};   // Lowercase mortality labels (ids fit in a uint8_t).
+};
+
+/**
+ * The process-wide dictionaries shared by every structure.
+ * @return The dictionaries.
+ */
+inline Dictionaries& dictionaries() {
+    static Dictionaries instance;
+    return instance;
+}
+
+// Single-threaded dictionary of string views used while decoding one chunk. Its ids are
+// later remapped to the shared Dictionary ids.
+class LocalDictionary {
+private:
+    unordered_map<string_view, uint16_t> ids; // Name -> local id.
+
+public:
+    vector<string_view> names; // Names by local id, in first-seen order.
+
+    /**
+     * Get the local id of a name, adding it if needed. The name must outlive the dictionary.
+     * @param name The name to intern.
+     * @return The local id.
+     */
+    uint16_t intern(string_view name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        if (names.size() >= 65536) {
+            throw length_error("LocalDictionary: too many distinct values");
+        }
+        uint16_t id = static_cast<uint16_t>(names.size());
+        names.push_back(name);
+        ids.emplace(name, id);
+        return id;
+    }
+
+    /**
+     * Intern every local name into a shared dictionary.
+     * @param shared The shared dictionary.
+     * @return Mapping from local id to shared id.
+     */
+    vector<uint16_t> publish(Dictionary& shared) const {
+        vector<uint16_t> mapping;
+        mapping.reserve(names.size());
+        for (string_view name : names) {
+            mapping.push_back(shared.intern(name));
+        }
+        return mapping;
+    }
+};
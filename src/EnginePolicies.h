@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "Hash.h"
+
+using namespace std;
+
+// Compile-time policies for the templated engines (BasicHashTable, BasicRBTree,
+// BasicStateRecords). Key traits say how a key is stored, hashed and ordered; dedup policies
+// say which of two records with the same (disease, year, isMortality) survives. Everything is
+// static, so the chosen policy inlines into the probe, compare and upsert loops.
+
+// Keys stored as strings and looked up by string_view (state names).
+struct StringKey {
+    using Stored = string;     // Key as kept in the structure.
+    using View = string_view;  // Key as passed to lookups.
+
+    static Stored store(View key) { return Stored(key); }
+    static uint64_t hash(View key) { return hashString(key); }
+    static bool equal(View a, const Stored& b) { return a == b; }
+    static int compare(View a, const Stored& b) { return a.compare(b); }
+};
+
+// Integer keys, such as state ids interned in dictionaries(); hashing and comparing are a few
+// instructions and no string is touched.
+template <typename Int>
+struct IntegerKey {
+    static_assert(is_integral<Int>::value, "IntegerKey needs an integral key type");
+    using Stored = Int;
+    using View = Int;
+
+    static Stored store(View key) { return key; }
+    static uint64_t hash(View key) { return hashInteger(static_cast<uint64_t>(key)); }
+    static bool equal(View a, Stored b) { return a == b; }
+    static int compare(View a, Stored b) { return (a > b) - (a < b); }
+};
+
+// Key traits picked from the key type: integers use IntegerKey, everything else StringKey.
+template <typename Key>
+using KeyTraitsFor = conditional_t<is_integral<Key>::value, IntegerKey<Key>, StringKey>;
+
+// Keep the record with the larger death count (the rule used for the CDI data).
+struct KeepLargest {
+    static constexpr bool monotonic = true; // A stored count never decreases.
+
+    static bool replaces(int32_t stored, int32_t incoming) { return incoming > stored; }
+};
+
+// Keep the most recently inserted record.
+struct KeepLatest {
+    static constexpr bool monotonic = false;
+
+    static bool replaces(int32_t, int32_t) { return true; }
+};
+
+// Keep the first record seen; later duplicates are ignored.
+struct KeepFirst {
+    static constexpr bool monotonic = true;
+
+    static bool replaces(int32_t, int32_t) { return false; }
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Dictionary.h"
+#include "QueryResult.h"
+#include "StateRecords.h"
+#include "Stats.h"
+
+using namespace std;
+
+// Ordered index over states kept in flat arrays, for the read-mostly case.
+// States and their records are stored in one vector sorted by state name, with a parallel
+// array of 8-byte key prefixes so most comparisons are a single integer compare. After
+// finalize(), lookups walk an Eytzinger (BFS-order) copy of the prefixes, which keeps the
+// first levels of every search in the same few cache lines.
+class FlatIndex {
+private:
+    vector<pair<string, StateRecords>> entries; // States and their records, sorted by state.
+    vector<uint64_t> prefixes;                  // prefixFor(entries[i].first), sorted like entries.
+    vector<uint64_t> eytzPrefix;                // Prefixes in Eytzinger order, 1-based (slot 0 unused).
+    vector<uint32_t> eytzEntry;                 // Entry index of each Eytzinger slot.
+    bool finalized;                             // Whether the Eytzinger arrays match entries.
+
+    /**
+     * Pack the first 8 bytes of a key big-endian, so comparing prefixes as integers orders
+     * them like the strings they come from.
+     * @param key The key.
+     * @return The packed prefix.
+     */
+    static uint64_t prefixFor(string_view key) {
+        uint64_t prefix = 0;
+        size_t n = min<size_t>(key.size(), 8);
+        for (size_t i = 0; i < n; i++) {
+            prefix |= static_cast<uint64_t>(static_cast<unsigned char>(key[i])) << (56 - 8 * i);
+        }
+        return prefix;
+    }
+
+    /**
+     * Whether entry i orders before the key.
+     */
+    bool entryLess(size_t i, uint64_t prefix, string_view key) const {
+        STATS_COUNT(flatSteps);
+        if (prefixes[i] != prefix) {
+            return prefixes[i] < prefix;
+        }
+        STATS_COUNT(stringCompares);
+        return string_view(entries[i].first) < key;
+    }
+
+    /**
+     * Binary search over the sorted arrays.
+     * @param key The key to look for.
+     * @return Index of the first entry not less than key.
+     */
+    size_t lowerBound(string_view key) const {
+        STATS_COUNT(flatSearches);
+        uint64_t prefix = prefixFor(key);
+        size_t lo = 0, hi = entries.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (entryLess(mid, prefix, key)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    /**
+     * Fill the Eytzinger arrays from the sorted arrays by an in-order walk of the implicit tree.
+     * @param next Next sorted index to place.
+     * @param k Current Eytzinger slot (1-based).
+     */
+    void layout(size_t& next, size_t k) {
+        if (k > entries.size()) {
+            return;
+        }
+        layout(next, 2 * k);
+        eytzPrefix[k] = prefixes[next];
+        eytzEntry[k] = static_cast<uint32_t>(next);
+        next++;
+        layout(next, 2 * k + 1);
+    }
+
+    /**
+     * Locate a key.
+     * @param key The key to look for.
+     * @return The entry index, or entries.size() if absent.
+     */
+    size_t findIndex(string_view key) const {
+        if (!finalized) {
+            size_t i = lowerBound(key);
+            return (i < entries.size() && entries[i].first == key) ? i : entries.size();
+        }
+
+        STATS_COUNT(flatSearches);
+        uint64_t prefix = prefixFor(key);
+        size_t n = entries.size();
+        size_t k = 1;
+        while (k <= n) {
+            // Four levels down the 16 descendants share a cache line; don't form pointers past the end
+            if (16 * k < eytzPrefix.size()) {
+                __builtin_prefetch(eytzPrefix.data() + 16 * k);
+            }
+            STATS_COUNT(flatSteps);
+            uint64_t p = eytzPrefix[k];
+            bool less = p != prefix ? p < prefix : string_view(entries[eytzEntry[k]].first) < key;
+            k = 2 * k + (less ? 1 : 0);
+        }
+        // Undo the trailing right turns to land on the lower bound
+        k >>= __builtin_ffsll(static_cast<long long>(~k));
+        if (k == 0 || eytzPrefix[k] != prefix) {
+            return entries.size();
+        }
+        size_t i = eytzEntry[k];
+        return entries[i].first == key ? i : entries.size();
+    }
+
+    /**
+     * Find the records of a state, adding an empty entry in sorted position if needed.
+     * @param key The state.
+     * @return The state's records.
+     */
+    StateRecords& findOrAdd(string_view key) {
+        size_t i = lowerBound(key);
+        if (i < entries.size() && entries[i].first == key) {
+            return entries[i].second;
+        }
+        entries.emplace(entries.begin() + i, string(key), StateRecords());
+        prefixes.insert(prefixes.begin() + i, prefixFor(key));
+        finalized = false;
+        return entries[i].second;
+    }
+
+public:
+    FlatIndex() : finalized(false) {}
+
+    /**
+     * Insert a record given as text, interning its columns into dictionaries().
+     * @param key The state key.
+     * @param disease The disease name.
+     * @param year The year of the record.
+     * @param deathCount The number of deaths reported.
+     * @param isMortality The (lowercase) mortality label.
+     */
+    void insert(string_view key, string_view disease, int year, int deathCount, string_view isMortality) {
+        Dictionaries& dict = dictionaries();
+        insert(key, hashTableVars(dict.states.intern(key), dict.diseases.intern(disease), year, deathCount,
+                                  static_cast<uint8_t>(dict.mortality.intern(isMortality))));
+    }
+
+    /**
+     * Insert a new record. If the state already exists, update the disease information if necessary.
+     * @param key The state key.
+     * @param info The disease information to insert.
+     * @return What the upsert changed, for keeping derived totals up to date.
+     */
+    UpsertResult insert(string_view key, const hashTableVars& info) {
+        return findOrAdd(key).upsert(info);
+    }
+
+    /**
+     * Merge another index into this one using the same upsert rule as insert.
+     * @param other The index to merge from.
+     * @param observe Callback receiving (const hashTableVars& record, const UpsertResult& change)
+     *                for every record merged, for keeping derived totals up to date.
+     */
+    template <typename Fn>
+    void merge(const FlatIndex& other, Fn&& observe) {
+        other.forEach([&](const string& state, const StateRecords& records) {
+            StateRecords& target = findOrAdd(state);
+            for (const auto& entry : records) {
+                observe(entry, target.upsert(entry));
+            }
+        });
+    }
+
+    void merge(const FlatIndex& other) {
+        merge(other, [](const hashTableVars&, const UpsertResult&) {});
+    }
+
+    /**
+     * Build the Eytzinger search arrays. Call once loading is done; later inserts of new
+     * states fall back to binary search until finalize() is called again.
+     */
+    void finalize() {
+        eytzPrefix.assign(entries.size() + 1, 0);
+        eytzEntry.assign(entries.size() + 1, 0);
+        size_t next = 0;
+        layout(next, 1);
+        finalized = true;
+    }
+
+    /**
+     * Look up the records of a state without printing anything.
+     * @param key The state.
+     * @return The state's records, or nullptr if the state is not present.
+     */
+    const StateRecords* find(string_view key) const {
+        size_t i = findIndex(key);
+        return i == entries.size() ? nullptr : &entries[i].second;
+    }
+
+    /**
+     * Visit every state and its records in ascending state order.
+     * @param fn Callback receiving (const string& state, const StateRecords& records).
+     */
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (const auto& entry : entries) {
+            fn(entry.first, entry.second);
+        }
+    }
+
+    /**
+     * Visit the states in [low, high] in ascending order, with the same bounds as
+     * RBTree::forEachInRange: the high end is compared on its first high.size() characters, so
+     * ("A", "M") includes "Michigan", and an empty bound is open.
+     * @param low Smallest state to visit.
+     * @param high Largest state (prefix) to visit.
+     * @param fn Callback receiving (const string& state, const StateRecords& records).
+     */
+    template <typename Fn>
+    void forEachInRange(string_view low, string_view high, Fn&& fn) const {
+        for (size_t i = lowerBound(low); i < entries.size(); i++) {
+            if (!high.empty() && string_view(entries[i].first).substr(0, high.size()) > high) {
+                break;
+            }
+            fn(entries[i].first, entries[i].second);
+        }
+    }
+
+    // Number of states stored in the index.
+    size_t size() const { return entries.size(); }
+
+    /**
+     * Display the death count for a given state and disease.
+     * @param state The state to query.
+     * @param disease The disease to query.
+     */
+    void displayDeathCount(const string& state, const string& disease) const {
+        OutputBuffer out(cout);
+        formatDeathCount(out, state, disease, lookup(*this, state, disease));
+    }
+};
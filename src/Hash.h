@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+using namespace std;
+
+// String hashing based on wyhash (final version 4), which mixes 8 bytes at a time
+// through a 64x64 -> 128 bit multiply. It has no trouble with anagrams or short keys.
+namespace wyhash {
+
+static constexpr uint64_t secret0 = 0xa0761d6478bd642full;
+static constexpr uint64_t secret1 = 0xe7037ed1a0b428dbull;
+static constexpr uint64_t secret2 = 0x8ebc6af09c88c6e3ull;
+static constexpr uint64_t secret3 = 0x589965cc75374cc3ull;
+
+inline void mum(uint64_t& a, uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    a = lo;
+    b = hi;
+#endif
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+    mum(a, b);
+    return a ^ b;
+}
+
+inline uint64_t read8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t read4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint64_t read3(const uint8_t* p, size_t k) {
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+/**
+ * Hash a byte range.
+ * @param key Pointer to the first byte.
+ * @param len Number of bytes.
+ * @param seed Seed value.
+ * @return The 64-bit hash.
+ */
+inline uint64_t hash(const void* key, size_t len, uint64_t seed = 0) {
+    const uint8_t* p = static_cast<const uint8_t*>(key);
+    seed ^= mix(seed ^ secret0, secret1);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mix(read8(p) ^ secret1, read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ secret2, read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ secret3, read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read8(p) ^ secret1, read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+    a ^= secret1;
+    b ^= seed;
+    mum(a, b);
+    return mix(a ^ secret0 ^ len, b ^ secret1);
+}
+
+} // namespace wyhash
+
+/**
+ * Hash a string with wyhash.
+ * @param key The string to hash.
+ * @return The 64-bit hash.
+ */
+inline uint64_t hashString(string_view key) {
+    return wyhash::hash(key.data(), key.size());
+}
+
+/**
+ * Hash a 64-bit integer (wyhash's integer mixer).
+ * @param key The value to hash.
+ * @return The 64-bit hash.
+ */
+inline uint64_t hashInteger(uint64_t key) {
+    return wyhash::mix(key ^ wyhash::secret0, wyhash::secret1);
+}
@@ -1,79 +1,263 @@
 #pragma once
 
-using namespace std;
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
-// Structure to hold information about a disease in a particular year and state.
-struct hashTableVars {
-    string disease;       // Name of the disease.
-    int year;             // Year of the record.
-    int deathCount;       // Number of deaths reported.
-    string isMortality;   // Mortality status (e.g., "yes" or "no").
+#include "Dictionary.h"
+#include "EnginePolicies.h"
+#include "Hash.h"
+#include "QueryResult.h"
+#include "StateRecords.h"
+#include "Stats.h"
 
-    // Constructor to initialize a disease record.
-    hashTableVars(const string& d, int y, int dc, const string& im)
-            : disease(d), year(y), deathCount(dc), isMortality(im) {}
-};
+using namespace std;
 
 // Class representing a hash table to store state-disease records.
-class HashTable {
+// Open addressing with Robin Hood probing: a flat bucket array holds a probe distance,
+// an 8-bit hash fingerprint and an index into a dense array of (state, records) entries.
+// Key is the state key type (string names or integer ids), Record and Dedup choose the
+// record type and duplicate rule, and Traits supplies hashing and equality for Key.
+template <typename Key, typename Record = hashTableVars, typename Dedup = KeepLargest,
+          typename Traits = KeyTraitsFor<Key>>
+class BasicHashTable {
+public:
+    using KeyView = typename Traits::View;              // Key as passed to lookups.
+    using Records = BasicStateRecords<Record, Dedup>;   // Records of one key.
+
 private:
-    static const int hashGroups = 100;  // Number of hash groups (buckets) in the table.
-    vector<list<pair<string, list<hashTableVars>>>> table; // Hash table represented as a vector of lists.
+    // One slot of the probe sequence. distAndFingerprint == 0 marks an empty bucket.
+    struct Bucket {
+        uint32_t distAndFingerprint; // Probe distance + 1 in the upper 24 bits, hash fingerprint in the low 8.
+        uint32_t entryIndex;         // Index of the entry in entries.
+    };
+
+    static constexpr uint32_t distInc = 1u << 8;       // Increment of one probe step in distAndFingerprint.
+    static constexpr uint32_t fingerprintMask = distInc - 1;
+    static constexpr size_t initialBuckets = 64;       // Bucket count of an empty table.
+    static constexpr double maxLoadFactor = 0.8;       // Grow once entries exceed this fraction of buckets.
+
+    vector<Bucket> buckets;                            // Power-of-two sized probe array.
+    vector<pair<typename Traits::Stored, Records>> entries; // States and their records, stored densely.
+    int shift;                                         // 64 - log2(buckets.size()); maps a hash to its home bucket.
+
+    uint32_t distAndFingerprintFor(uint64_t hash) const {
+        return distInc | static_cast<uint32_t>(hash & fingerprintMask);
+    }
+
+    size_t homeBucket(uint64_t hash) const {
+        return static_cast<size_t>(hash >> shift);
+    }
+
+    size_t nextBucket(size_t index) const {
+        return (index + 1) & (buckets.size() - 1);
+    }
+
+    // Count one lookup that ended at probe distance daf (STATS_* are no-ops unless ENGINE_STATS is defined).
+    static void recordProbes([[maybe_unused]] uint32_t daf) {
+        STATS_COUNT(hashLookups);
+        STATS_ADD(hashProbes, daf / distInc);
+        STATS_MAX(hashMaxProbe, daf / distInc);
+    }
+
+    /**
+     * Locate the bucket that refers to a key.
+     * @param key The key to look for.
+     * @return The bucket index, or buckets.size() if the key is absent.
+     */
+    size_t findBucket(KeyView key) const {
+        uint64_t hash = hashFunction(key);
+        uint32_t daf = distAndFingerprintFor(hash);
+        size_t index = homeBucket(hash);
+        while (true) {
+            const Bucket& bucket = buckets[index];
+            if (bucket.distAndFingerprint == daf && Traits::equal(key, entries[bucket.entryIndex].first)) {
+                recordProbes(daf);
+                return index;
+            }
+            // Robin Hood invariant: once our distance exceeds the resident's, the key cannot be further on.
+            if (bucket.distAndFingerprint < daf) {
+                recordProbes(daf);
+                return buckets.size();
+            }
+            daf += distInc;
+            index = nextBucket(index);
+        }
+    }
+
+    /**
+     * Place an entry index into the probe array, displacing richer residents.
+     * @param hash The hash of the entry's key.
+     * @param entryIndex Index of the entry in entries.
+     */
+    void placeEntry(uint64_t hash, uint32_t entryIndex) {
+        Bucket carried{distAndFingerprintFor(hash), entryIndex};
+        size_t index = homeBucket(hash);
+        while (buckets[index].distAndFingerprint != 0) {
+            if (carried.distAndFingerprint > buckets[index].distAndFingerprint) {
+                swap(carried, buckets[index]);
+                STATS_COUNT(hashDisplacements);
+            }
+            carried.distAndFingerprint += distInc;
+            index = nextBucket(index);
+        }
+        buckets[index] = carried;
+    }
+
+    /**
+     * Resize the probe array and re-place every entry.
+     * @param bucketCount The new bucket count (a power of two).
+     */
+    void rehash(size_t bucketCount) {
+        STATS_COUNT(hashRehashes);
+        buckets.assign(bucketCount, Bucket{0, 0});
+        shift = 64;
+        for (size_t n = bucketCount; n > 1; n >>= 1) {
+            shift--;
+        }
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            placeEntry(hashFunction(entries[i].first), i);
+        }
+    }
+
+    /**
+     * Find the records of a state, adding an empty entry if it is not present yet.
+     * @param key The state.
+     * @return The state's record list.
+     */
+    Records& findOrAdd(KeyView key) {
+        size_t index = findBucket(key);
+        if (index != buckets.size()) {
+            return entries[buckets[index].entryIndex].second;
+        }
+        if (entries.size() + 1 > buckets.size() * maxLoadFactor) {
+            rehash(buckets.size() * 2);
+        }
+        entries.emplace_back(Traits::store(key), Records());
+        placeEntry(hashFunction(key), static_cast<uint32_t>(entries.size() - 1));
+        return entries.back().second;
+    }
 
 public:
-    // Constructor to initialize the hash table with a predefined number of buckets.
-    HashTable() {
-        table.resize(hashGroups);
+    // Constructor to initialize the hash table with a small number of buckets; it grows as states are added.
+    BasicHashTable() {
+        rehash(initialBuckets);
     }
 
     /**
-     * Hash function to compute the index for a given key.
+     * Hash function to compute the hash of a given key.
      * @param key The key to hash.
-     * @return The hash index for the key.
+     * @return The 64-bit wyhash of the key.
      */
-    int hashFunction(const string& key) {
-        int hash = 0;
-        for (char ch : key) {
-            hash += ch;
-        }
-        return hash % hashGroups;
+    static uint64_t hashFunction(KeyView key) {
+        return Traits::hash(key);
     }
 
     /**
      * Insert a new record into the hash table.
      * If the key (state) already exists, update the record if necessary.
+     * Duplicates are found through the state's (disease, year, isMortality) index.
      * @param key The key (state) for the record.
      * @param info The record to insert.
+     * @return What the upsert changed, for keeping derived totals up to date.
+     */
+    UpsertResult insertItem(KeyView key, const Record& info) {
+        return findOrAdd(key).upsert(info);
+    }
+
+    /**
+     * Insert a record given as text, interning its columns into dictionaries() (string keys only).
+     * @param key The key (state) for the record.
+     * @param disease The disease name.
+     * @param year The year of the record.
+     * @param deathCount The number of deaths reported.
+     * @param isMortality The (lowercase) mortality label.
+     */
+    void insertItem(string_view key, string_view disease, int year, int deathCount, string_view isMortality) {
+        Dictionaries& dict = dictionaries();
+        insertItem(key, hashTableVars(dict.states.intern(key), dict.diseases.intern(disease), year, deathCount,
+                                      static_cast<uint8_t>(dict.mortality.intern(isMortality))));
+    }
+
+    /**
+     * Merge another table into this one using the same upsert rule as insertItem.
+     * States and records keep the order in which they were first seen, so merging
+     * partial tables in input order reproduces a serial build.
+     * @param other The table to merge from.
+     * @param observe Callback receiving (const Record& record, const UpsertResult& change) for
+     *                every record merged, for keeping derived totals up to date.
      */
-    void insertItem(const string& key, const hashTableVars& info) {
-        int hashValue = hashFunction(key);
-        auto& cell = table[hashValue];
-        auto bItr = begin(cell);
-
-        bool keyExists = false;
-        for (; bItr != end(cell); bItr++) {
-            if (bItr->first == key) {
-                keyExists = true;
-                for (auto& entry : bItr->second) {
-                    if (entry.disease == info.disease && entry.year == info.year && entry.isMortality == info.isMortality) {
-                        if (info.deathCount > entry.deathCount) {
-                            entry.deathCount = info.deathCount;
-                        }
-                        // Found the duplicate, no need to add a new entry
-                        return;
-                    }
-                }
-                // If no exact match found, add the new info
-                bItr->second.push_back(info);
-                return;
+    template <typename Fn>
+    void merge(const BasicHashTable& other, Fn&& observe) {
+        other.forEach([&](const typename Traits::Stored& state, const Records& records) {
+            Records& target = findOrAdd(state);
+            for (const auto& entry : records) {
+                observe(entry, target.upsert(entry));
             }
+        });
+    }
+
+    void merge(const BasicHashTable& other) {
+        merge(other, [](const Record&, const UpsertResult&) {});
+    }
+
+    /**
+     * Visit every state and its record list.
+     * @param fn Callback receiving (const key& state, const Records& records).
+     */
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (const auto& entry : entries) {
+            fn(entry.first, entry.second);
         }
+    }
 
-        if (!keyExists) {
-            list<hashTableVars> diseaseList;
-            diseaseList.push_back(info);
-            cell.emplace_back(key, diseaseList);
+    /**
+     * Look up the records of a state without printing anything.
+     * @param key The state.
+     * @return The state's records, or nullptr if the state is not present.
+     */
+    const Records* find(KeyView key) const {
+        size_t index = findBucket(key);
+        return index == buckets.size() ? nullptr : &entries[buckets[index].entryIndex].second;
+    }
+
+    // Number of states stored in the table.
+    size_t size() const { return entries.size(); }
+
+    /**
+     * Remove a state and its records without printing anything.
+     * @param key The key (state) of the record to remove.
+     * @return True if the state was present.
+     */
+    bool erase(KeyView key) {
+        size_t index = findBucket(key);
+        if (index == buckets.size()) {
+            return false;
+        }
+
+        // Backward-shift deletion: pull following displaced buckets one step closer to home
+        uint32_t removed = buckets[index].entryIndex;
+        size_t next = nextBucket(index);
+        while (buckets[next].distAndFingerprint >= 2 * distInc) {
+            buckets[index] = {buckets[next].distAndFingerprint - distInc, buckets[next].entryIndex};
+            index = next;
+            next = nextBucket(next);
+        }
+        buckets[index] = {0, 0};
+
+        // Keep entries dense by moving the last entry into the hole
+        uint32_t last = static_cast<uint32_t>(entries.size() - 1);
+        if (removed != last) {
+            size_t lastBucket = findBucket(entries[last].first);
+            buckets[lastBucket].entryIndex = removed;
+            entries[removed] = std::move(entries[last]);
         }
+        entries.pop_back();
+        return true;
     }
 
     /**
@@ -81,21 +265,9 @@ public:
      * @param key The key (state) of the record to remove.
      */
     void removeItem(const string& key) {
-        int hashValue = hashFunction(key);
-        auto& cell = table[hashValue];
-        auto bItr = begin(cell);
-        bool keyExists = false;
-
-        for (; bItr != end(cell); bItr++) {
-            if (bItr->first == key) {
-                keyExists = true;
-                bItr = cell.erase(bItr);
-                cout << "[INFO] Key removed.\n";
-                break;
-            }
-        }
-
-        if (!keyExists) {
+        if (erase(key)) {
+            cout << "[INFO] Key removed.\n";
+        } else {
             cout << "[WARNING] Key not found. Pair not removed.\n";
         }
     }
@@ -105,34 +277,11 @@ public:
      * @param state The state to query.
      * @param disease The disease to query.
      */
-    void displayDeathCount(const string& state, const string& disease) {
-        int hashValue = hashFunction(state);
-        auto& cell = table[hashValue];
-        auto bItr = begin(cell);
-        bool stateExists = false;
-
-        for (; bItr != end(cell); bItr++) {
-            if (bItr->first == state) {
-                stateExists = true;
-                bool diseaseFound = false;
-                for (const auto& entry : bItr->second) {
-                    if (entry.disease == disease) {
-                        cout << "State: " << state << " Disease: " << disease
-                             << " Year: " << entry.year
-                             << " Death Count: " << entry.deathCount
-                             << " Mortality: " << entry.isMortality << "\n";
-                        diseaseFound = true;
-                    }
-                }
-                if (!diseaseFound) {
-                    cout << "Disease " << disease << " not found in state " << state << ".\n";
-                }
-                break;
-            }
-        }
-
-        if (!stateExists) {
-            cout << "State " << state << " not found.\n";
-        }
+    void displayDeathCount(const string& state, const string& disease) const {
+        OutputBuffer out(cout);
+        formatDeathCount(out, state, disease, lookup(*this, state, disease));
     }
-};
\ No newline at end of file
+};
+
+// The hash table used by the program: state names to CDI records.
+using HashTable = BasicHashTable<string>;
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "CSVLoader.h"
+#include "Dictionary.h"
+#include "RecordBatch.h"
+
+using namespace std;
+
+// Incremental ingestion: decode only the rows that are new since the structures were built,
+// either appended to the loaded CSV or supplied as a separate delta file. Decoding touches
+// only the new bytes, so a refresh costs time proportional to the delta. Applying the rows
+// uses the same max-deathCount upsert as the initial build, so reading a row twice is harmless.
+
+/**
+ * Decode the complete lines appended to a CSV since a byte offset.
+ * @param path The CSV file.
+ * @param offset Bytes already loaded; advanced past the lines decoded.
+ * @param batch Receives the new records, with ids from dictionaries().
+ * @param error Receives a message on failure.
+ * @return False if the file can't be opened or is now shorter than offset.
+ */
+inline bool decodeAppended(const string& path, uint64_t& offset, RecordBatch& batch, string& error) {
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        error = "can't open " + path;
+        return false;
+    }
+    if (file.size() < offset) {
+        error = path + " is shorter than the " + to_string(offset) + " bytes already loaded; restart to reload it";
+        return false;
+    }
+    const char* end = file.data() + file.size();
+    const char* begin = offset == 0 ? skipHeader(file) : file.data() + offset;
+    const char* stop = lastLineEnd(begin, end);
+    batch.decode(begin, stop);
+    batch.publish(dictionaries());
+    offset = static_cast<uint64_t>(stop - file.data());
+    return true;
+}
+
+/**
+ * Decode a delta file with the same columns (and header line) as the main CSV.
+ * @param path The delta file.
+ * @param batch Receives the records, with ids from dictionaries().
+ * @param error Receives a message on failure.
+ * @return False if the file can't be opened.
+ */
+inline bool decodeDelta(const string& path, RecordBatch& batch, string& error) {
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        error = "can't open " + path;
+        return false;
+    }
+    batch.decode(skipHeader(file), file.data() + file.size());
+    batch.publish(dictionaries());
+    return true;
+}
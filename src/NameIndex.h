@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Compact trie over a set of names (such as the interned states or diseases), keyed on the
+// ASCII-lowercased name so every lookup is case-insensitive. Nodes and edges live in two flat
+// arrays, each node's edges contiguous and sorted by label, and each node lists the original
+// names that end there. It answers exact case-insensitive matches, prefix completion in
+// alphabetical order, and suggestions within an edit distance, by walking only the branches
+// that can still match instead of scanning every name.
+class NameIndex {
+private:
+    struct Node {
+        uint32_t firstEdge = 0; // Index of the node's first edge in edges.
+        uint32_t edgeCount = 0; // Number of edges.
+        uint32_t firstName = 0; // Names ending at this node: names[firstName, firstName + nameCount).
+        uint32_t nameCount = 0;
+    };
+
+    struct Edge {
+        char label;     // Lowercased character.
+        uint32_t child; // Node the edge leads to.
+    };
+
+    vector<Node> nodes;   // nodes[0] is the root.
+    vector<Edge> edges;   // Edges of every node.
+    vector<string> names; // Original names, ordered by lowercased name.
+    size_t longest = 0;   // Length of the longest name.
+    size_t sources = 0;   // Number of names passed to build(), duplicates included.
+
+    static char fold(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; }
+
+    static string folded(string_view text) {
+        string key(text);
+        for (char& c : key) {
+            c = fold(c);
+        }
+        return key;
+    }
+
+    /**
+     * Build the node for keys[first, last), which share their first depth characters.
+     * @return The node's index.
+     */
+    uint32_t buildNode(const vector<string>& keys, size_t first, size_t last, size_t depth) {
+        uint32_t index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        // Keys that end here sort before the longer ones
+        size_t split = first;
+        while (split < last && keys[split].size() == depth) {
+            split++;
+        }
+        nodes[index].firstName = static_cast<uint32_t>(first);
+        nodes[index].nameCount = static_cast<uint32_t>(split - first);
+
+        // One edge per distinct next character; reserve them before the children add theirs
+        vector<size_t> groups;
+        for (size_t i = split; i < last; i++) {
+            if (i == split || keys[i][depth] != keys[i - 1][depth]) {
+                groups.push_back(i);
+            }
+        }
+        groups.push_back(last);
+        uint32_t firstEdge = static_cast<uint32_t>(edges.size());
+        nodes[index].firstEdge = firstEdge;
+        nodes[index].edgeCount = static_cast<uint32_t>(groups.size() - 1);
+        edges.resize(edges.size() + groups.size() - 1);
+        for (size_t g = 0; g + 1 < groups.size(); g++) {
+            char label = keys[groups[g]][depth];
+            uint32_t child = buildNode(keys, groups[g], groups[g + 1], depth + 1);
+            edges[firstEdge + g] = Edge{label, child};
+        }
+        return index;
+    }
+
+    /**
+     * Follow an edge.
+     * @return The child, or 0 (the root, never a child) if the node has no such edge.
+     */
+    uint32_t child(uint32_t node, char label) const {
+        const Node& n = nodes[node];
+        for (uint32_t e = n.firstEdge; e < n.firstEdge + n.edgeCount; e++) {
+            if (edges[e].label == label) {
+                return edges[e].child;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * Walk a lowercased key from the root.
+     * @return The node reached, or 0 if the key leaves the trie (the empty key gives the root).
+     */
+    uint32_t descend(string_view key) const {
+        uint32_t node = 0;
+        for (char c : key) {
+            node = child(node, c);
+            if (node == 0) {
+                return 0;
+            }
+        }
+        return node;
+    }
+
+    /**
+     * Depth-first edit distance search below a node, one DP row per level.
+     * @param rows One row of query.size() + 1 distances per depth; the row at depth holds the
+     *             distances from the query's prefixes to the key of node.
+     */
+    void suggestBelow(uint32_t node, size_t depth, const string& query, vector<int>& rows, int maxDistance,
+                      vector<pair<int, uint32_t>>& found) const {
+        const size_t width = query.size() + 1;
+        const int* row = &rows[depth * width];
+        int* next = &rows[(depth + 1) * width];
+        const Node& n = nodes[node];
+        if (n.nameCount > 0 && row[width - 1] <= maxDistance) {
+            found.emplace_back(row[width - 1], node);
+        }
+        for (uint32_t e = n.firstEdge; e < n.firstEdge + n.edgeCount; e++) {
+            char label = edges[e].label;
+            next[0] = row[0] + 1;
+            int best = next[0];
+            for (size_t j = 1; j < width; j++) {
+                next[j] = min({row[j] + 1, next[j - 1] + 1, row[j - 1] + (query[j - 1] == label ? 0 : 1)});
+                best = min(best, next[j]);
+            }
+            // Every key below is at least best edits away
+            if (best <= maxDistance) {
+                suggestBelow(edges[e].child, depth + 1, query, rows, maxDistance, found);
+            }
+        }
+    }
+
+public:
+    NameIndex() {
+        build({});
+    }
+
+    /**
+     * Replace the contents with a set of names.
+     * @param all The names; duplicates are kept once.
+     */
+    void build(const vector<string_view>& all) {
+        vector<pair<string, string>> entries; // (lowercased, original)
+        entries.reserve(all.size());
+        sources = all.size();
+        for (string_view name : all) {
+            entries.emplace_back(folded(name), string(name));
+        }
+        sort(entries.begin(), entries.end());
+        entries.erase(unique(entries.begin(), entries.end()), entries.end());
+
+        vector<string> keys;
+        names.clear();
+        longest = 0;
+        for (auto& entry : entries) {
+            longest = max(longest, entry.first.size());
+            keys.push_back(std::move(entry.first));
+            names.push_back(std::move(entry.second));
+        }
+        nodes.clear();
+        edges.clear();
+        buildNode(keys, 0, keys.size(), 0);
+    }
+
+    /**
+     * Find a name regardless of case.
+     * @param text The name as typed.
+     * @return The stored name (the first alphabetically if several differ only in case), or ""
+     *         if there is none.
+     */
+    string_view match(string_view text) const {
+        uint32_t node = descend(folded(text));
+        if ((node == 0 && !text.empty()) || nodes[node].nameCount == 0) {
+            return string_view();
+        }
+        return names[nodes[node].firstName];
+    }
+
+    /**
+     * Names starting with a prefix, regardless of case, in alphabetical order.
+     * @param prefix The prefix ("" lists every name).
+     * @param limit Largest number of names to return.
+     */
+    vector<string_view> complete(string_view prefix, size_t limit) const {
+        vector<string_view> found;
+        uint32_t start = descend(folded(prefix));
+        if (start == 0 && !prefix.empty()) {
+            return found;
+        }
+        // Pre-order walk with edges pushed in reverse, so names come out sorted
+        vector<uint32_t> stack{start};
+        while (!stack.empty() && found.size() < limit) {
+            const Node& n = nodes[stack.back()];
+            stack.pop_back();
+            for (uint32_t i = 0; i < n.nameCount && found.size() < limit; i++) {
+                found.push_back(names[n.firstName + i]);
+            }
+            for (uint32_t e = n.firstEdge + n.edgeCount; e > n.firstEdge; e--) {
+                stack.push_back(edges[e - 1].child);
+            }
+        }
+        return found;
+    }
+
+    /**
+     * Names within an edit distance (insertions, deletions and substitutions, ignoring case)
+     * of a text, closest first, ties in alphabetical order.
+     * @param text The text as typed.
+     * @param maxDistance Largest edit distance to report.
+     * @param limit Largest number of names to return.
+     */
+    vector<string_view> suggest(string_view text, int maxDistance, size_t limit) const {
+        // Every name is more than maxDistance deletions away from a longer query
+        if (maxDistance < 0 || text.size() > longest + static_cast<size_t>(maxDistance)) {
+            return {};
+        }
+        string query = folded(text);
+        vector<int> rows((longest + 2) * (query.size() + 1));
+        for (size_t j = 0; j <= query.size(); j++) {
+            rows[j] = static_cast<int>(j);
+        }
+        vector<pair<int, uint32_t>> found; // (distance, node); nodes are numbered alphabetically.
+        suggestBelow(0, 0, query, rows, maxDistance, found);
+        sort(found.begin(), found.end());
+
+        vector<string_view> result;
+        for (const auto& entry : found) {
+            const Node& n = nodes[entry.second];
+            for (uint32_t i = 0; i < n.nameCount && result.size() < limit; i++) {
+                result.push_back(names[n.firstName + i]);
+            }
+        }
+        return result;
+    }
+
+    // Number of distinct names.
+    size_t size() const { return names.size(); }
+
+    // Number of names the index was built from, duplicates included. An index built from an
+    // append-only list (such as a dictionary snapshot) is current while the list has this many.
+    size_t sourceCount() const { return sources; }
+
+    // Memory held by the nodes and edges (not the names), in bytes.
+    size_t bytes() const { return nodes.size() * sizeof(Node) + edges.size() * sizeof(Edge); }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Number of worker threads to use for parallel work.
+ * @return The hardware thread count, or 1 if it is unknown.
+ */
+inline size_t workerCount() {
+    return max<size_t>(1, thread::hardware_concurrency());
+}
+
+/**
+ * Run fn(0) .. fn(n - 1), each on its own thread, and wait for all of them.
+ * Index 0 runs on the calling thread.
+ * @param n Number of tasks.
+ * @param fn Callback receiving the task index.
+ */
+template <typename Fn>
+void parallelFor(size_t n, Fn&& fn) {
+    vector<thread> workers;
+    workers.reserve(n > 0 ? n - 1 : 0);
+    for (size_t i = 1; i < n; i++) {
+        workers.emplace_back([&fn, i] { fn(i); });
+    }
+    if (n > 0) {
+        fn(0);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Fixed set of worker threads running submitted tasks in FIFO order, for work that arrives
+// over time (such as server requests) rather than as one batch known up front.
+class WorkerPool {
+private:
+    mutex lock;                    // Guards tasks and stopping.
+    condition_variable wake;       // Signalled when a task arrives or the pool stops.
+    deque<function<void()>> tasks; // Tasks not yet started.
+    bool stopping = false;         // Set by the destructor; workers exit once tasks is empty.
+    vector<thread> workers;
+
+    void work() {
+        while (true) {
+            function<void()> task;
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    /**
+     * @param threads Number of worker threads (at least one).
+     */
+    explicit WorkerPool(size_t threads) {
+        for (size_t i = 0; i < max<size_t>(1, threads); i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    // Runs the tasks already submitted, then joins the workers.
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * Queue a task for the next free worker.
+     * @param task The task.
+     */
+    void submit(function<void()> task) {
+        {
+            lock_guard<mutex> guard(lock);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // Number of worker threads.
+    size_t size() const { return workers.size(); }
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "Dictionary.h"
+#include "StateRecords.h"
+
+using namespace std;
+
+// Result of a (state, disease) lookup. It refers to the structure's own records, so it does
+// no copying and no I/O; it stays valid until the structure is modified.
+struct QueryResult {
+    const StateRecords* records = nullptr; // The state's records, or nullptr if the state is absent.
+    uint16_t disease = 0;                  // Disease id (valid when diseaseFound).
+    bool diseaseFound = false;             // Whether the disease name is known.
+
+    // Whether the state exists.
+    bool stateFound() const { return records != nullptr; }
+
+    // Number of matching records.
+    size_t size() const {
+        return (records == nullptr || !diseaseFound) ? 0 : records->forDisease(disease, [](const hashTableVars&) {});
+    }
+
+    /**
+     * Visit the matching records in (year, isMortality) order.
+     * @param fn Callback receiving a const hashTableVars&.
+     * @return The number of records visited.
+     */
+    template <typename Fn>
+    size_t forEach(Fn&& fn) const {
+        return (records == nullptr || !diseaseFound) ? 0 : records->forDisease(disease, fn);
+    }
+};
+
+/**
+ * Look up the records of one disease in one state.
+ * @param structure Any structure with find(state) returning const StateRecords*.
+ * @param state The state to query.
+ * @param disease The disease to query.
+ * @return The matching records.
+ */
+template <typename Structure>
+QueryResult lookup(const Structure& structure, string_view state, string_view disease) {
+    QueryResult result;
+    result.records = structure.find(state);
+    if (result.records != nullptr) {
+        result.diseaseFound = dictionaries().diseases.find(disease, result.disease);
+    }
+    return result;
+}
+
+// Output stage for query results: text is collected in memory and written to the stream in
+// large pieces, so formatting many records doesn't pay for a stream call per field.
+class OutputBuffer {
+private:
+    static constexpr size_t flushSize = 64 * 1024;
+
+    ostream& out;  // Destination stream.
+    string buffer; // Text not yet written.
+
+public:
+    explicit OutputBuffer(ostream& stream) : out(stream) {
+        buffer.reserve(flushSize + 256);
+    }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    ~OutputBuffer() {
+        flush();
+    }
+
+    OutputBuffer& operator<<(string_view text) {
+        buffer.append(text.data(), text.size());
+        if (buffer.size() >= flushSize) {
+            flush();
+        }
+        return *this;
+    }
+
+    OutputBuffer& operator<<(char c) {
+        buffer.push_back(c);
+        return *this;
+    }
+
+    OutputBuffer& operator<<(long long value) {
+        char digits[24];
+        auto end = to_chars(digits, digits + sizeof(digits), value).ptr;
+        return *this << string_view(digits, end - digits);
+    }
+
+    OutputBuffer& operator<<(int value) { return *this << static_cast<long long>(value); }
+    OutputBuffer& operator<<(size_t value) { return *this << static_cast<long long>(value); }
+
+    /**
+     * Write everything collected so far to the stream.
+     */
+    void flush() {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+};
+
+/**
+ * Format the result of a (state, disease) lookup the way the interactive search prints it.
+ * @param out Output stage to append to.
+ * @param state The state that was queried.
+ * @param disease The disease that was queried.
+ * @param result The lookup result.
+ */
+inline void formatDeathCount(OutputBuffer& out, string_view state, string_view disease, const QueryResult& result) {
+    if (!result.stateFound()) {
+        out << "State " << state << " not found.\n";
+        return;
+    }
+
+    const Dictionary& mortality = dictionaries().mortality;
+    size_t found = result.forEach([&](const hashTableVars& entry) {
+        out << "State: " << state << " Disease: " << disease
+            << " Year: " << static_cast<int>(entry.year)
+            << " Death Count: " << static_cast<int>(entry.deathCount)
+            << " Mortality: " << string_view(mortality.name(entry.isMortality)) << '\n';
+    });
+    if (found == 0) {
+        out << "Disease " << disease << " not found in state " << state << ".\n";
+    }
+}
@@ -0,0 +1,514 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Parallel.h"
+
+using namespace std;
+
+// Line protocol server: clients send one request per line and get exactly one response line
+// per request, in request order, so they may pipeline as many requests as they like. An epoll
+// loop on one thread accepts connections and moves bytes; complete request lines are handed
+// to a worker pool in chunks, and each connection's responses are put back in order before
+// they are written. Linux only (epoll, eventfd, signalfd).
+
+// Where a server listens: a TCP port on 127.0.0.1, or a Unix domain socket path.
+struct ServerAddress {
+    bool tcp = false;  // TCP on localhost, or a Unix domain socket.
+    uint16_t port = 0; // TCP port.
+    string path;       // Unix socket path.
+
+    // Human-readable form, e.g. "127.0.0.1:7070" or "unix:/tmp/q.sock".
+    string describe() const { return tcp ? "127.0.0.1:" + to_string(port) : "unix:" + path; }
+};
+
+/**
+ * Parse a listen/connect address: a number is a localhost TCP port, anything else a Unix
+ * socket path (an optional "unix:" prefix is stripped).
+ * @param text The address.
+ * @param address Receives the parsed address.
+ * @return False if the text is empty or the port is out of range.
+ */
+inline bool parseServerAddress(const string& text, ServerAddress& address) {
+    if (text.empty()) {
+        return false;
+    }
+    if (text.find_first_not_of("0123456789") == string::npos) {
+        long port = text.size() <= 5 ? stol(text) : 0;
+        if (port <= 0 || port > 65535) {
+            return false;
+        }
+        address.tcp = true;
+        address.port = static_cast<uint16_t>(port);
+        return true;
+    }
+    address.tcp = false;
+    address.path = text.rfind("unix:", 0) == 0 ? text.substr(5) : text;
+    return !address.path.empty() && address.path.size() < sizeof(sockaddr_un::sun_path);
+}
+
+/**
+ * Open a blocking connection to a server.
+ * @param address The server address.
+ * @param error Receives a message on failure.
+ * @return The socket, or -1 on failure.
+ */
+inline int connectToServer(const ServerAddress& address, string& error) {
+    int fd = socket(address.tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = strerror(errno);
+        return -1;
+    }
+    int status;
+    if (address.tcp) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(address.port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        status = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, address.path.data(), address.path.size());
+        status = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+    if (status < 0) {
+        error = "can't connect to " + address.describe() + ": " + strerror(errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Totals reported when a server stops.
+struct ServerCounters {
+    uint64_t connections = 0; // Connections accepted.
+    uint64_t requests = 0;    // Request lines answered.
+    uint64_t bytesIn = 0;     // Bytes read from clients.
+    uint64_t bytesOut = 0;    // Bytes written to clients.
+};
+
+class QueryServer {
+public:
+    // Answers one request line (without its newline) by appending one response line to out.
+    // Called concurrently from the worker threads.
+    using Handler = function<void(string_view line, string& out)>;
+
+private:
+    static constexpr size_t readSize = 64 * 1024;          // Bytes read per recv call.
+    static constexpr size_t linesPerTask = 128;            // Request lines per worker task.
+    static constexpr size_t outputLimit = 4 * 1024 * 1024; // Unsent bytes at which reading pauses.
+    static constexpr size_t readLimit = 4 * readSize;      // Bytes read from one client per wakeup.
+    static constexpr uint64_t taskLimit = 64;              // Tasks in flight at which reading pauses.
+    static constexpr size_t maxLineLength = 64 * 1024;     // Longer request lines close the connection.
+
+    // epoll tags of the non-client descriptors; client connection ids start above them.
+    static constexpr uint64_t listenTag = 0, wakeTag = 1, signalTag = 2, firstConnection = 3;
+
+    // A client connection, owned by the event loop thread.
+    struct Connection {
+        int fd = -1;
+        string input;               // Bytes read but not yet handed out as complete lines.
+        string output;              // Responses in order, not yet fully written.
+        size_t sent = 0;            // Bytes of output already written.
+        uint64_t nextTask = 0;      // Sequence number of the next task handed out.
+        uint64_t nextResponse = 0;  // Sequence number of the next task whose responses go out.
+        map<uint64_t, string> done; // Responses of finished tasks that are waiting for earlier ones.
+        bool readClosed = false;    // The client shut down its side.
+        bool reading = true;        // Whether EPOLLIN is armed.
+        bool writing = false;       // Whether EPOLLOUT is armed.
+    };
+
+    // Responses of one finished task, passed from a worker back to the event loop.
+    struct Completion {
+        uint64_t connection;
+        uint64_t sequence;
+        string output;
+        size_t requests;
+    };
+
+    Handler handler;
+    size_t threads;
+    int epollFd = -1;
+    int listenFd = -1;
+    int wakeFd = -1;    // eventfd the workers signal when completions are waiting.
+    int signalFd = -1;  // SIGINT/SIGTERM, so the loop can stop cleanly.
+    string boundPath;   // Unix socket file this server created, removed when it stops.
+    unordered_map<uint64_t, Connection> connections;
+    uint64_t nextConnection = firstConnection;
+    mutex completionLock;           // Guards completions.
+    vector<Completion> completions; // Finished tasks not yet collected by the loop.
+    ServerCounters totals;
+
+    /**
+     * Create, bind and listen on the server socket.
+     * @return False (with a message on stderr) on failure.
+     */
+    bool listenOn(const ServerAddress& address) {
+        listenFd = socket(address.tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) {
+            cerr << "socket: " << strerror(errno) << "\n";
+            return false;
+        }
+        int status;
+        if (address.tcp) {
+            int one = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(address.port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            status = bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        } else {
+            // A socket file left by an earlier run would make bind fail; anything else at the
+            // path is not ours to remove
+            struct stat existing;
+            if (lstat(address.path.c_str(), &existing) == 0) {
+                if (!S_ISSOCK(existing.st_mode)) {
+                    cerr << "Can't listen on " << address.describe() << ": the path exists and is not a socket\n";
+                    return false;
+                }
+                unlink(address.path.c_str());
+            }
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            memcpy(addr.sun_path, address.path.data(), address.path.size());
+            status = bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            if (status == 0) {
+                boundPath = address.path;
+            }
+        }
+        if (status < 0 || listen(listenFd, SOMAXCONN) < 0) {
+            cerr << "Can't listen on " << address.describe() << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Register a descriptor with the epoll set under a tag.
+    void watch(int fd, uint64_t tag, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = tag;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    // Re-arm a connection's events from its reading/writing flags. EPOLLRDHUP is level-triggered
+    // and stays set after the client shuts down its side, so it is only armed while reading.
+    void rearm(uint64_t id, Connection& conn) {
+        epoll_event event{};
+        event.events = (conn.reading ? EPOLLIN | EPOLLRDHUP : 0u) | (conn.writing ? EPOLLOUT : 0u);
+        event.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+    }
+
+    void closeConnection(uint64_t id) {
+        auto it = connections.find(id);
+        if (it == connections.end()) {
+            return;
+        }
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        close(it->second.fd);
+        connections.erase(it);
+    }
+
+    void acceptClients(bool tcp) {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return; // EAGAIN once the backlog is empty; other errors affect only that client
+            }
+            if (tcp) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            uint64_t id = nextConnection++;
+            connections[id].fd = fd;
+            watch(fd, id, EPOLLIN | EPOLLRDHUP);
+            totals.connections++;
+        }
+    }
+
+    /**
+     * Hand a block of complete lines to the workers, split into tasks of linesPerTask lines.
+     */
+    void dispatch(WorkerPool& pool, uint64_t id, Connection& conn, string_view block) {
+        while (!block.empty()) {
+            size_t end = 0;
+            for (size_t lines = 0; lines < linesPerTask && end < block.size(); lines++) {
+                end = block.find('\n', end) + 1;
+            }
+            uint64_t sequence = conn.nextTask++;
+            pool.submit([this, id, sequence, chunk = string(block.substr(0, end))] {
+                Completion completion{id, sequence, string(), 0};
+                string_view rest(chunk);
+                while (!rest.empty()) {
+                    size_t newline = rest.find('\n');
+                    string_view line = rest.substr(0, newline);
+                    rest.remove_prefix(newline + 1);
+                    if (!line.empty() && line.back() == '\r') {
+                        line.remove_suffix(1);
+                    }
+                    handler(line, completion.output);
+                    completion.requests++;
+                }
+                {
+                    lock_guard<mutex> guard(completionLock);
+                    completions.push_back(std::move(completion));
+                }
+                uint64_t one = 1;
+                [[maybe_unused]] ssize_t written = write(wakeFd, &one, sizeof(one));
+            });
+            block.remove_prefix(end);
+        }
+    }
+
+    /**
+     * Read what a client sent, up to readLimit bytes so one client can't hold up the others,
+     * and dispatch its complete lines.
+     * @return False if the connection failed or sent an overlong line, and was closed.
+     */
+    bool readClient(WorkerPool& pool, uint64_t id, Connection& conn) {
+        char buffer[readSize];
+        for (size_t total = 0; total < readLimit;) {
+            ssize_t got = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (got > 0) {
+                conn.input.append(buffer, static_cast<size_t>(got));
+                totals.bytesIn += static_cast<uint64_t>(got);
+                total += static_cast<size_t>(got);
+                continue;
+            }
+            if (got == 0) {
+                conn.readClosed = true;
+                conn.reading = false;
+                // A last request without a newline still gets its answer
+                if (!conn.input.empty() && conn.input.back() != '\n') {
+                    conn.input.push_back('\n');
+                }
+                rearm(id, conn);
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            closeConnection(id);
+            return false;
+        }
+        size_t complete = conn.input.rfind('\n');
+        if (complete != string::npos) {
+            dispatch(pool, id, conn, string_view(conn.input).substr(0, complete + 1));
+            conn.input.erase(0, complete + 1);
+        }
+        if (conn.input.size() > maxLineLength) {
+            closeConnection(id);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Write as much pending output as the socket takes, pausing or resuming reads to keep
+     * unsent output and tasks in flight bounded, and close the connection once it is finished.
+     */
+    void writeClient(uint64_t id, Connection& conn) {
+        while (conn.sent < conn.output.size()) {
+            ssize_t put = send(conn.fd, conn.output.data() + conn.sent, conn.output.size() - conn.sent, MSG_NOSIGNAL);
+            if (put > 0) {
+                conn.sent += static_cast<size_t>(put);
+                totals.bytesOut += static_cast<uint64_t>(put);
+                continue;
+            }
+            if (put < 0 && errno == EINTR) {
+                continue;
+            }
+            if (put < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            closeConnection(id);
+            return;
+        }
+        if (conn.sent == conn.output.size()) {
+            conn.output.clear();
+            conn.sent = 0;
+        } else if (conn.sent > outputLimit) {
+            conn.output.erase(0, conn.sent);
+            conn.sent = 0;
+        }
+
+        if (conn.readClosed && conn.output.empty() && conn.nextResponse == conn.nextTask) {
+            closeConnection(id);
+            return;
+        }
+        bool writing = !conn.output.empty();
+        bool reading = !conn.readClosed && conn.output.size() - conn.sent < outputLimit &&
+                       conn.nextTask - conn.nextResponse < taskLimit;
+        if (writing != conn.writing || reading != conn.reading) {
+            conn.writing = writing;
+            conn.reading = reading;
+            rearm(id, conn);
+        }
+    }
+
+    /**
+     * Move finished tasks into their connections' output, in sequence order, and write.
+     */
+    void collectCompletions() {
+        uint64_t count;
+        [[maybe_unused]] ssize_t got = read(wakeFd, &count, sizeof(count));
+        vector<Completion> finished;
+        {
+            lock_guard<mutex> guard(completionLock);
+            finished.swap(completions);
+        }
+        vector<uint64_t> touched;
+        for (Completion& completion : finished) {
+            totals.requests += completion.requests;
+            auto it = connections.find(completion.connection);
+            if (it == connections.end()) {
+                continue; // The client went away before its answers were ready
+            }
+            Connection& conn = it->second;
+            conn.done.emplace(completion.sequence, std::move(completion.output));
+            while (!conn.done.empty() && conn.done.begin()->first == conn.nextResponse) {
+                conn.output += conn.done.begin()->second;
+                conn.done.erase(conn.done.begin());
+                conn.nextResponse++;
+            }
+            touched.push_back(completion.connection);
+        }
+        for (uint64_t id : touched) {
+            auto it = connections.find(id);
+            if (it != connections.end()) {
+                writeClient(id, it->second);
+            }
+        }
+    }
+
+public:
+    /**
+     * @param threads Number of worker threads answering requests.
+     * @param answer Answers one request line.
+     */
+    QueryServer(size_t threads, Handler answer) : handler(std::move(answer)), threads(max<size_t>(1, threads)) {}
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    ~QueryServer() {
+        for (auto& entry : connections) {
+            close(entry.second.fd);
+        }
+        for (int fd : {listenFd, wakeFd, signalFd, epollFd}) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        if (!boundPath.empty()) {
+            unlink(boundPath.c_str());
+        }
+    }
+
+    /**
+     * Listen and answer requests until SIGINT or SIGTERM.
+     * @param address Where to listen.
+     * @param ready Called once the server is listening, if set.
+     * @return False if the server could not start.
+     */
+    bool run(const ServerAddress& address, const function<void()>& ready = nullptr) {
+        // Block the stop signals before any worker starts so only the signalfd sees them
+        sigset_t stopSignals;
+        sigemptyset(&stopSignals);
+        sigaddset(&stopSignals, SIGINT);
+        sigaddset(&stopSignals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        signalFd = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0 || signalFd < 0 || !listenOn(address)) {
+            return false;
+        }
+        watch(listenFd, listenTag, EPOLLIN);
+        watch(wakeFd, wakeTag, EPOLLIN);
+        watch(signalFd, signalTag, EPOLLIN);
+        if (ready) {
+            ready();
+        }
+
+        {
+            WorkerPool pool(threads);
+            vector<epoll_event> events(256);
+            bool stopping = false;
+            while (!stopping) {
+                int count = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), -1);
+                if (count < 0 && errno != EINTR) {
+                    cerr << "epoll_wait: " << strerror(errno) << "\n";
+                    break;
+                }
+                for (int i = 0; i < count; i++) {
+                    uint64_t tag = events[i].data.u64;
+                    if (tag == listenTag) {
+                        acceptClients(address.tcp);
+                    } else if (tag == wakeTag) {
+                        collectCompletions();
+                    } else if (tag == signalTag) {
+                        stopping = true;
+                    } else {
+                        auto it = connections.find(tag);
+                        if (it == connections.end()) {
+                            continue;
+                        }
+                        uint32_t flags = events[i].events;
+                        // On a full hangup the client can't read answers any more
+                        if ((flags & (EPOLLERR | EPOLLHUP)) != 0) {
+                            closeConnection(tag);
+                            continue;
+                        }
+                        if ((flags & (EPOLLIN | EPOLLRDHUP)) != 0 && !it->second.readClosed &&
+                            !readClient(pool, tag, it->second)) {
+                            continue;
+                        }
+                        writeClient(tag, it->second);
+                    }
+                }
+            }
+            // The pool finishes its queued tasks before it is destroyed
+        }
+        if (!boundPath.empty()) {
+            unlink(boundPath.c_str());
+            boundPath.clear();
+        }
+        return true;
+    }
+
+    // Totals so far; read after run() returns.
+    const ServerCounters& counters() const { return totals; }
+};
@@ -1,59 +1,397 @@
 #pragma once
 
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "Arena.h"
+#include "Dictionary.h"
+#include "EnginePolicies.h"
+#include "QueryResult.h"
+#include "StateRecords.h"
+#include "Stats.h"
+
 using namespace std;
 
 // Enum representing the color of a node in the Red-Black Tree.
 enum Color { RED, BLACK };
 
 // Structure representing a node in the Red-Black Tree.
-struct Node {
-    string state; // State name.
-    list<hashTableVars> diseases; // List of disease records associated with the state.
+template <typename Stored, typename Records>
+struct RBNode {
+    Stored state; // State key.
+    Records diseases; // Disease records associated with the state.
     bool color; // Color of the node (RED or BLACK).
-    Node* left; // Pointer to the left child.
-    Node* right; // Pointer to the right child.
-    Node* parent; // Pointer to the parent node.
+    RBNode* left; // Pointer to the left child.
+    RBNode* right; // Pointer to the right child.
+    RBNode* parent; // Pointer to the parent node.
+    unordered_map<uint32_t, DeathAggregate> subtree; // Deaths per (disease, year) over this node's subtree.
 
-    // Constructor to initialize a node with a state and disease information.
-    Node(const string& key, const hashTableVars& info) : state(key), color(RED), left(nullptr), right(nullptr), parent(nullptr) {
-        diseases.push_back(info);
-    }
+    // Constructor to initialize a node with a state and no records yet.
+    explicit RBNode(const Stored& key) : state(key), color(RED), left(nullptr), right(nullptr), parent(nullptr) {}
 };
 
 // Class representing a Red-Black Tree.
-class RBTree {
+// Key is the state key type (string names or integer ids), Record and Dedup choose the record
+// type and duplicate rule, and Traits supplies the key ordering. The state-range queries
+// (forEachInRange, aggregate, topStates) compare name prefixes and need string keys.
+template <typename Key, typename Record = hashTableVars, typename Dedup = KeepLargest,
+          typename Traits = KeyTraitsFor<Key>>
+class BasicRBTree {
+public:
+    using KeyView = typename Traits::View;              // Key as passed to lookups.
+    using Records = BasicStateRecords<Record, Dedup>;   // Records of one key.
+
 private:
+    using Node = RBNode<typename Traits::Stored, Records>;
+
+    ObjectPool<Node> nodes; // Storage for every node, including TNULL; freed in bulk with the tree.
     Node* root; // Pointer to the root node of the tree.
     Node* TNULL; // Pointer to the sentinel null node used to simplify tree operations.
+    int minYear; // Smallest year stored in the tree.
+    int maxYear; // Largest year stored in the tree.
+
+    // Key of a (disease, year) cell in Node::subtree.
+    static uint32_t aggregateKey(uint16_t disease, int year) {
+        return (static_cast<uint32_t>(disease) << 16) | static_cast<uint16_t>(year);
+    }
 
     /**
-     * Initialize a NULL node (sentinel) with default values.
-     * @param node The node to initialize.
-     * @param parent The parent of the NULL node.
+     * Recompute a node's subtree aggregates from its own records and its children.
+     * @param node The node to refresh.
      */
-    void initializeNULLNode(Node* node, Node* parent) {
-        node->state = "";
-        node->color = BLACK;
-        node->left = nullptr;
-        node->right = nullptr;
-        node->parent = parent;
+    void recomputeSubtree(Node* node) {
+        node->subtree.clear();
+        for (const auto& entry : node->diseases) {
+            node->subtree[aggregateKey(entry.disease, entry.year)].add(entry.deathCount);
+        }
+        for (Node* child : {node->left, node->right}) {
+            for (const auto& cell : child->subtree) {
+                node->subtree[cell.first].add(cell.second);
+            }
+        }
+    }
+
+    /**
+     * Recompute one (disease, year) cell of a node's subtree aggregates from its own records
+     * and its children's cells. A cell left with no records is dropped.
+     * @param node The node to refresh.
+     * @param key The (disease, year) cell.
+     */
+    void recomputeCell(Node* node, uint32_t key) {
+        DeathAggregate cell;
+        int year = static_cast<uint16_t>(key);
+        node->diseases.forDiseaseInYears(static_cast<uint16_t>(key >> 16), year, year, [&](const Record& entry) {
+            cell.add(entry.deathCount);
+        });
+        for (Node* child : {node->left, node->right}) {
+            auto it = child->subtree.find(key);
+            if (it != child->subtree.end()) {
+                cell.add(it->second);
+            }
+        }
+        if (cell.count == 0) {
+            node->subtree.erase(key);
+        } else {
+            node->subtree[key] = cell;
+        }
+    }
+
+    /**
+     * Apply a record change to the subtree aggregates of a node and all of its ancestors.
+     * @param node The node whose records changed.
+     * @param key The (disease, year) cell that changed.
+     * @param change The change reported by StateRecords::upsert.
+     */
+    void propagate(Node* node, uint32_t key, const UpsertResult& change) {
+        if (!change.added && change.current == change.previous) {
+            return;
+        }
+        // A count that went down may have been the maximum, so rebuild the cell instead
+        if constexpr (!Dedup::monotonic) {
+            if (!change.added && change.current < change.previous) {
+                for (; node != nullptr; node = node->parent) {
+                    recomputeCell(node, key);
+                }
+                return;
+            }
+        }
+        for (; node != nullptr; node = node->parent) {
+            node->subtree[key].apply(change);
+        }
     }
 
     /**
-     * Helper function to search for a node with a given key in the tree.
-     * @param node The node to start the search from.
-     * @param key The key to search for.
-     * @return The node with the given key, or TNULL if not found.
+     * Sum the subtree aggregates of a node over a year window.
      */
-    Node* searchTreeHelper(Node* node, const string& key) {
-        if (node == TNULL || key == node->state) {
-            return node;
+    DeathAggregate subtreeWindow(const Node* node, uint16_t disease, int fromYear, int toYear) const {
+        DeathAggregate total;
+        for (int year = max(fromYear, minYear); year <= min(toYear, maxYear); year++) {
+            auto it = node->subtree.find(aggregateKey(disease, year));
+            if (it != node->subtree.end()) {
+                total.add(it->second);
+            }
         }
+        return total;
+    }
+
+    /**
+     * Sum a node's own records over a year window.
+     */
+    static DeathAggregate ownWindow(const Node* node, uint16_t disease, int fromYear, int toYear) {
+        DeathAggregate total;
+        node->diseases.forDiseaseInYears(disease, fromYear, toYear, [&](const Record& entry) {
+            total.add(entry.deathCount);
+        });
+        return total;
+    }
 
-        if (key < node->state) {
-            return searchTreeHelper(node->left, key);
+    // Whether a state is at or above the low end of a range (empty = unbounded).
+    static bool aboveLow(const string& state, string_view low) {
+        return low.empty() || string_view(state) >= low;
+    }
+
+    // Whether a state is at or below the high end of a range, comparing only the first
+    // high.size() characters so "M" includes every state starting with M (empty = unbounded).
+    static bool belowHigh(const string& state, string_view high) {
+        return high.empty() || string_view(state).substr(0, high.size()) <= high;
+    }
+
+    /**
+     * Helper function to aggregate the states in [low, high] of a subtree, using whole-subtree
+     * aggregates wherever a subtree lies entirely inside the range.
+     */
+    void aggregateHelper(const Node* node, string_view low, string_view high, bool lowOpen, bool highOpen,
+                         uint16_t disease, int fromYear, int toYear, DeathAggregate& total) const {
+        if (node == TNULL) {
+            return;
+        }
+        if (lowOpen && highOpen) {
+            total.add(subtreeWindow(node, disease, fromYear, toYear));
+            return;
+        }
+        bool geLow = lowOpen || aboveLow(node->state, low);
+        bool leHigh = highOpen || belowHigh(node->state, high);
+        if (geLow && leHigh) {
+            total.add(ownWindow(node, disease, fromYear, toYear));
+            aggregateHelper(node->left, low, high, lowOpen, true, disease, fromYear, toYear, total);
+            aggregateHelper(node->right, low, high, true, highOpen, disease, fromYear, toYear, total);
+        } else if (!geLow) {
+            aggregateHelper(node->right, low, high, lowOpen, highOpen, disease, fromYear, toYear, total);
+        } else {
+            aggregateHelper(node->left, low, high, lowOpen, highOpen, disease, fromYear, toYear, total);
+        }
+    }
+
+    /**
+     * Helper function for topStates: visit states in range, skipping subtrees whose total is
+     * too small to beat the current N-th best state.
+     */
+    void topStatesHelper(const Node* node, string_view low, string_view high, uint16_t disease, int fromYear,
+                         int toYear, size_t n, vector<pair<string, DeathAggregate>>& best) const {
+        if (node == TNULL) {
+            return;
+        }
+        auto worse = [](const pair<string, DeathAggregate>& a, const pair<string, DeathAggregate>& b) {
+            return a.second.sum > b.second.sum;
+        };
+        // Death counts are non-negative, so no state in a subtree can exceed the subtree's total
+        if (best.size() == n && subtreeWindow(node, disease, fromYear, toYear).sum <= best.front().second.sum) {
+            return;
+        }
+        if (aboveLow(node->state, low)) {
+            topStatesHelper(node->left, low, high, disease, fromYear, toYear, n, best);
+        }
+        if (aboveLow(node->state, low) && belowHigh(node->state, high)) {
+            DeathAggregate own = ownWindow(node, disease, fromYear, toYear);
+            if (own.count > 0 && (best.size() < n || own.sum > best.front().second.sum)) {
+                if (best.size() == n) {
+                    pop_heap(best.begin(), best.end(), worse);
+                    best.pop_back();
+                }
+                best.emplace_back(node->state, own);
+                push_heap(best.begin(), best.end(), worse);
+            }
+        }
+        if (belowHigh(node->state, high)) {
+            topStatesHelper(node->right, low, high, disease, fromYear, toYear, n, best);
+        }
+    }
+
+    /**
+     * Leftmost node of a subtree.
+     */
+    template <typename NodePtr>
+    NodePtr minimum(NodePtr node) const {
+        while (node->left != TNULL) {
+            node = node->left;
+        }
+        return node;
+    }
+
+    /**
+     * In-order successor of a node, found through parent links.
+     * @return The next node, or TNULL after the last one.
+     */
+    const Node* successor(const Node* node) const {
+        if (node->right != TNULL) {
+            return minimum(node->right);
+        }
+        const Node* parent = node->parent;
+        while (parent != nullptr && node == parent->right) {
+            node = parent;
+            parent = parent->parent;
+        }
+        return parent == nullptr ? TNULL : parent;
+    }
+
+    /**
+     * Find the node of a key without recursion.
+     * @return The node, or TNULL if the key is absent.
+     */
+    Node* findNode(KeyView key) const {
+        Node* node = root;
+        [[maybe_unused]] uint64_t depth = 0;
+        while (node != TNULL) {
+            depth++;
+            int order = Traits::compare(key, node->state);
+            if (order == 0) {
+                break;
+            }
+            node = order < 0 ? node->left : node->right;
+        }
+        recordSearch(depth);
+        return node;
+    }
+
+    // Count one descent that compared the key against depth nodes (no-op unless ENGINE_STATS is defined).
+    static void recordSearch([[maybe_unused]] uint64_t depth) {
+        STATS_COUNT(treeSearches);
+        STATS_ADD(treeDepth, depth);
+        STATS_MAX(treeMaxDepth, depth);
+        STATS_ADD(stringCompares, depth);
+    }
+
+    /**
+     * Replace the subtree rooted at u with the subtree rooted at v.
+     * @param u The subtree being replaced.
+     * @param v The replacement (may be TNULL, whose parent is then set for balanceDelete).
+     */
+    void transplant(Node* u, Node* v) {
+        if (u->parent == nullptr) {
+            root = v;
+        }
+        else if (u == u->parent->left) {
+            u->parent->left = v;
+        }
+        else {
+            u->parent->right = v;
+        }
+        v->parent = u->parent;
+    }
+
+    /**
+     * Restore the Red-Black properties after removing a black node.
+     * @param x The node that took the removed node's place (may be TNULL).
+     * @param changed Receives nodes moved by rotations, whose aggregates need rebuilding.
+     */
+    void balanceDelete(Node* x, vector<Node*>& changed) {
+        Node* s;
+        while (x != root && x->color == BLACK) {
+            if (x == x->parent->left) {
+                s = x->parent->right;
+                if (s->color == RED) {
+                    s->color = BLACK;
+                    x->parent->color = RED;
+                    leftRotate(x->parent);
+                    changed.push_back(x->parent);
+                    s = x->parent->right;
+                }
+                if (s->left->color == BLACK && s->right->color == BLACK) {
+                    s->color = RED;
+                    x = x->parent;
+                }
+                else {
+                    if (s->right->color == BLACK) {
+                        s->left->color = BLACK;
+                        s->color = RED;
+                        rightRotate(s);
+                        changed.push_back(s);
+                        s = x->parent->right;
+                    }
+                    s->color = x->parent->color;
+                    x->parent->color = BLACK;
+                    s->right->color = BLACK;
+                    leftRotate(x->parent);
+                    changed.push_back(x->parent);
+                    x = root;
+                }
+            }
+            else {
+                s = x->parent->left;
+                if (s->color == RED) {
+                    s->color = BLACK;
+                    x->parent->color = RED;
+                    rightRotate(x->parent);
+                    changed.push_back(x->parent);
+                    s = x->parent->left;
+                }
+                if (s->right->color == BLACK && s->left->color == BLACK) {
+                    s->color = RED;
+                    x = x->parent;
+                }
+                else {
+                    if (s->left->color == BLACK) {
+                        s->right->color = BLACK;
+                        s->color = RED;
+                        leftRotate(s);
+                        changed.push_back(s);
+                        s = x->parent->left;
+                    }
+                    s->color = x->parent->color;
+                    x->parent->color = BLACK;
+                    s->left->color = BLACK;
+                    rightRotate(x->parent);
+                    changed.push_back(x->parent);
+                    x = root;
+                }
+            }
+        }
+        x->color = BLACK;
+    }
+
+    /**
+     * Rebuild some cells of the subtree aggregates of the given nodes and all their ancestors,
+     * children before parents. Used after a delete, which leaves every aggregate correct except
+     * in the cells of the records that were removed or moved.
+     * @param changed Nodes whose subtrees changed.
+     * @param cells The (disease, year) cells to rebuild.
+     */
+    void rebuildAggregates(const vector<Node*>& changed, const vector<uint32_t>& cells) {
+        vector<pair<size_t, Node*>> pending; // (depth, node)
+        unordered_set<Node*> seen;
+        for (Node* start : changed) {
+            for (Node* node = start; node != nullptr && node != TNULL && seen.insert(node).second; node = node->parent) {
+                size_t depth = 0;
+                for (Node* up = node->parent; up != nullptr; up = up->parent) {
+                    depth++;
+                }
+                pending.emplace_back(depth, node);
+            }
+        }
+        sort(pending.begin(), pending.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        for (const auto& entry : pending) {
+            for (uint32_t key : cells) {
+                recomputeCell(entry.second, key);
+            }
         }
-        return searchTreeHelper(node->right, key);
     }
 
     /**
@@ -112,6 +450,7 @@ private:
      * @param x The node to rotate.
      */
     void leftRotate(Node* x) {
+        STATS_COUNT(leftRotations);
         Node* y = x->right;
         x->right = y->left;
         if (y->left != TNULL) {
@@ -129,6 +468,10 @@ private:
         }
         y->left = x;
         x->parent = y;
+
+        // y now covers the subtree x used to cover
+        y->subtree = std::move(x->subtree);
+        recomputeSubtree(x);
     }
 
     /**
@@ -136,6 +479,7 @@ private:
      * @param x The node to rotate.
      */
     void rightRotate(Node* x) {
+        STATS_COUNT(rightRotations);
         Node* y = x->left;
         x->left = y->right;
         if (y->right != TNULL) {
@@ -153,52 +497,276 @@ private:
         }
         y->right = x;
         x->parent = y;
+
+        // y now covers the subtree x used to cover
+        y->subtree = std::move(x->subtree);
+        recomputeSubtree(x);
     }
 
-public:
-    // Constructor to initialize the Red-Black Tree.
-    RBTree() {
-        TNULL = new Node("", hashTableVars("", 0, 0, ""));
+    /**
+     * Copy a subtree of another tree into this tree's pool. Records are shared with the source
+     * until either side updates them (see StateRecords.h); aggregates are copied.
+     * @param source Root of the subtree to copy.
+     * @param sourceNull The other tree's sentinel.
+     * @param parent Parent of the copy (nullptr for the root).
+     * @return The copied subtree, or TNULL if source is empty.
+     */
+    Node* copySubtree(const Node* source, const Node* sourceNull, Node* parent) {
+        if (source == sourceNull) {
+            return TNULL;
+        }
+        Node* node = nodes.create(source->state);
+        node->diseases = source->diseases;
+        node->color = source->color;
+        node->subtree = source->subtree;
+        node->parent = parent;
+        node->left = copySubtree(source->left, sourceNull, node);
+        node->right = copySubtree(source->right, sourceNull, node);
+        return node;
+    }
+
+    /**
+     * Allocate the sentinel of an empty tree. A moved-from tree has none until its next insert.
+     */
+    void createSentinel() {
+        TNULL = nodes.create(typename Traits::Stored());
         TNULL->color = BLACK;
         root = TNULL;
     }
 
+public:
+    // Constructor to initialize the Red-Black Tree.
+    BasicRBTree() : minYear(0), maxYear(-1) {
+        createSentinel();
+    }
+
+    // Nodes point at each other and at TNULL, so a copy rebuilds the node structure in its own
+    // pool. The records of each state are shared with the source until either tree updates them.
+    BasicRBTree(const BasicRBTree& other) : root(nullptr), TNULL(nullptr), minYear(other.minYear),
+                                            maxYear(other.maxYear) {
+        if (other.TNULL != nullptr) {
+            createSentinel();
+            root = copySubtree(other.root, other.TNULL, nullptr);
+        }
+    }
+
+    BasicRBTree& operator=(const BasicRBTree& other) {
+        BasicRBTree copy(other);
+        swap(copy);
+        return *this;
+    }
+
+    // Moving hands over the node pool; no node is copied or reallocated. The moved-from tree
+    // is left empty with no sentinel (move construction), so moving never allocates, or holds
+    // the previous contents (move assignment).
+    BasicRBTree(BasicRBTree&& other) noexcept : root(nullptr), TNULL(nullptr), minYear(0), maxYear(-1) {
+        swap(other);
+    }
+
+    BasicRBTree& operator=(BasicRBTree&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    // Every node, TNULL included, lives in the pool, which destroys them in one pass.
+    ~BasicRBTree() = default;
+
+    /**
+     * Exchange contents with another tree in constant time.
+     */
+    void swap(BasicRBTree& other) noexcept {
+        nodes.swap(other.nodes);
+        std::swap(root, other.root);
+        std::swap(TNULL, other.TNULL);
+        std::swap(minYear, other.minYear);
+        std::swap(maxYear, other.maxYear);
+    }
+
+    // Forward iterator over the nodes in ascending key order; walks parent links, no stack.
+    class const_iterator {
+    private:
+        const BasicRBTree* tree;
+        const Node* node;
+
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = Node;
+        using difference_type = ptrdiff_t;
+        using pointer = const Node*;
+        using reference = const Node&;
+
+        const_iterator(const BasicRBTree* owner, const Node* at) : tree(owner), node(at) {}
+
+        reference operator*() const { return *node; }
+        pointer operator->() const { return node; }
+
+        const_iterator& operator++() {
+            node = tree->successor(node);
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator before = *this;
+            ++*this;
+            return before;
+        }
+
+        bool operator==(const const_iterator& other) const { return node == other.node; }
+        bool operator!=(const const_iterator& other) const { return node != other.node; }
+    };
+
+    const_iterator begin() const { return const_iterator(this, root == TNULL ? TNULL : minimum(root)); }
+    const_iterator end() const { return const_iterator(this, TNULL); }
+
+    /**
+     * Look up the records of a state without printing anything.
+     * @param key The state.
+     * @return The state's records, or nullptr if the state is not present.
+     */
+    const Records* find(KeyView key) const {
+        const Node* node = findNode(key);
+        return node == TNULL ? nullptr : &node->diseases;
+    }
+
+    // Number of states stored in the tree.
+    size_t size() const { return TNULL == nullptr ? 0 : nodes.size() - 1; }
+
+    /**
+     * Remove a state and its records, rebalancing the tree. The node's slot is reused by
+     * later inserts.
+     * @param key The state.
+     * @return True if the state was present.
+     */
+    bool erase(KeyView key) {
+        Node* z = findNode(key);
+        if (z == TNULL) {
+            return false;
+        }
+
+        // Only the cells of z's records, and of the successor's if it moves, go stale
+        vector<uint32_t> cells;
+        auto collectCells = [&](const Node* node) {
+            for (const auto& entry : node->diseases) {
+                cells.push_back(aggregateKey(entry.disease, entry.year));
+            }
+        };
+        collectCells(z);
+
+        Node* y = z;
+        Node* x;
+        bool yOriginalColor = y->color;
+        if (z->left == TNULL) {
+            x = z->right;
+            transplant(z, z->right);
+        }
+        else if (z->right == TNULL) {
+            x = z->left;
+            transplant(z, z->left);
+        }
+        else {
+            // Two children: the successor takes z's place
+            y = minimum(z->right);
+            collectCells(y);
+            yOriginalColor = y->color;
+            x = y->right;
+            if (y->parent == z) {
+                x->parent = y;
+            }
+            else {
+                transplant(y, y->right);
+                y->right = z->right;
+                y->right->parent = y;
+            }
+            transplant(z, y);
+            y->left = z->left;
+            y->left->parent = y;
+            y->color = z->color;
+            // y now covers z's subtree without z
+            y->subtree = std::move(z->subtree);
+        }
+
+        // x's parent is the lowest node that lost part of its subtree
+        vector<Node*> changed{x->parent};
+        if (yOriginalColor == BLACK) {
+            balanceDelete(x, changed);
+        }
+        TNULL->parent = nullptr;
+        sort(cells.begin(), cells.end());
+        cells.erase(unique(cells.begin(), cells.end()), cells.end());
+        rebuildAggregates(changed, cells);
+        nodes.destroy(z);
+        return true;
+    }
+
+    /**
+     * Remove a record from the tree by its key.
+     * @param key The key (state) of the record to remove.
+     */
+    void removeItem(const string& key) {
+        if (erase(key)) {
+            cout << "[INFO] Key removed.\n";
+        } else {
+            cout << "[WARNING] Key not found. Pair not removed.\n";
+        }
+    }
+
+    /**
+     * Remove every state, keeping the tree usable.
+     */
+    void clear() {
+        BasicRBTree empty;
+        swap(empty);
+    }
+
+    /**
+     * Insert a record given as text, interning its columns into dictionaries() (string keys only).
+     * @param key The state key.
+     * @param disease The disease name.
+     * @param year The year of the record.
+     * @param deathCount The number of deaths reported.
+     * @param isMortality The (lowercase) mortality label.
+     */
+    void insert(string_view key, string_view disease, int year, int deathCount, string_view isMortality) {
+        Dictionaries& dict = dictionaries();
+        insert(key, hashTableVars(dict.states.intern(key), dict.diseases.intern(disease), year, deathCount,
+                                  static_cast<uint8_t>(dict.mortality.intern(isMortality))));
+    }
+
     /**
      * Insert a new record into the Red-Black Tree.
      * If the state already exists, update the disease information if necessary.
+     * Duplicates are found through the state's (disease, year, isMortality) index.
      * @param key The state key.
      * @param info The disease information to insert.
+     * @return What the upsert changed, for keeping derived totals up to date.
      */
-    void insert(const string& key, const hashTableVars& info) {
-        Node* node = new Node(key, info);
-        node->parent = nullptr;
-        node->left = TNULL;
-        node->right = TNULL;
-        node->color = RED;
+    UpsertResult insert(KeyView key, const Record& info) {
+        if (TNULL == nullptr) {
+            createSentinel();
+        }
+        if (minYear > maxYear) {
+            minYear = maxYear = info.year;
+        } else {
+            minYear = min<int>(minYear, info.year);
+            maxYear = max<int>(maxYear, info.year);
+        }
 
         Node* y = nullptr;
         Node* x = this->root;
+        [[maybe_unused]] uint64_t depth = 0;
 
         // Find the appropriate place to insert the new node
         while (x != TNULL) {
             y = x;
-            if (node->state == x->state) {
-                for (auto& entry : x->diseases) {
-                    if (entry.disease == info.disease && entry.year == info.year && entry.isMortality == info.isMortality) {
-                        if (info.deathCount > entry.deathCount) {
-                            entry.deathCount = info.deathCount;
-                        }
-                        // Found the duplicate, no need to add new entry
-                        delete node;  // Free the allocated memory for the new node
-                        return;
-                    }
-                }
-                // If no exact match found, add the new info
-                x->diseases.push_back(info);
-                delete node;  // Free the allocated memory for the new node
-                return;
+            depth++;
+            int cmp = Traits::compare(key, x->state);
+            if (cmp == 0) {
+                recordSearch(depth);
+                UpsertResult change = x->diseases.upsert(info);
+                propagate(x, aggregateKey(info.disease, info.year), change);
+                return change;
             }
-            if (node->state < x->state) {
+            if (cmp < 0) {
                 x = x->left;
             }
             else {
@@ -206,56 +774,137 @@ public:
             }
         }
 
+        recordSearch(depth);
+        Node* node = nodes.create(Traits::store(key));
+        node->left = TNULL;
+        node->right = TNULL;
+
         // Set the parent of the new node
         node->parent = y;
         if (y == nullptr) {
             root = node;
         }
-        else if (node->state < y->state) {
+        else if (Traits::compare(key, y->state) < 0) {
             y->left = node;
         }
         else {
             y->right = node;
         }
+        UpsertResult change = node->diseases.upsert(info);
+        propagate(node, aggregateKey(info.disease, info.year), change);
 
         // Fix any violations of the Red-Black Tree properties
         if (node->parent == nullptr) {
             node->color = BLACK;
-            return;
         }
-
-        if (node->parent->parent == nullptr) {
-            return;
+        else if (node->parent->parent != nullptr) {
+            balanceInsert(node);
         }
+        return change;
+    }
 
-        balanceInsert(node);
+    /**
+     * Merge another tree into this one using the same upsert rule as insert.
+     * @param other The tree to merge from.
+     * @param observe Callback receiving (const Record& record, const UpsertResult& change) for
+     *                every record merged, for keeping derived totals up to date.
+     */
+    template <typename Fn>
+    void merge(const BasicRBTree& other, Fn&& observe) {
+        other.forEach([&](const typename Traits::Stored& state, const Records& records) {
+            for (const auto& entry : records) {
+                observe(entry, insert(state, entry));
+            }
+        });
+    }
+
+    void merge(const BasicRBTree& other) {
+        merge(other, [](const Record&, const UpsertResult&) {});
     }
 
     /**
-     * Display the death count for a given state and disease.
-     * @param state The state to query.
-     * @param disease The disease to query.
+     * Visit every state and its record list in ascending state order.
+     * @param fn Callback receiving (const key& state, const Records& records).
      */
-    void displayDeathCount(const string& state, const string& disease) {
-        Node* node = searchTreeHelper(this->root, state);
-        if (node == TNULL) {
-            cout << "State " << state << " not found.\n";
-            return;
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (const Node& node : *this) {
+            fn(node.state, node.diseases);
         }
+    }
 
-        bool diseaseFound = false;
-        for (const auto& entry : node->diseases) {
-            if (entry.disease == disease) {
-                cout << "State: " << state << " Disease: " << disease
-                     << " Year: " << entry.year
-                     << " Death Count: " << entry.deathCount
-                     << " Mortality: " << entry.isMortality << "\n";
-                diseaseFound = true;
+    /**
+     * Visit the states in [low, high] in ascending order. The high end is compared on its
+     * first high.size() characters, so ("A", "M") includes "Michigan". An empty bound is open.
+     * @param low Smallest state to visit.
+     * @param high Largest state (prefix) to visit.
+     * @param fn Callback receiving (const string& state, const StateRecords& records).
+     */
+    template <typename Fn>
+    void forEachInRange(string_view low, string_view high, Fn&& fn) const {
+        // Descend to the first state at or above low, then walk successors until past high
+        const Node* first = TNULL;
+        for (const Node* node = root; node != TNULL;) {
+            if (aboveLow(node->state, low)) {
+                first = node;
+                node = node->left;
+            } else {
+                node = node->right;
             }
         }
+        for (const_iterator it(this, first); it != end() && belowHigh(it->state, high); ++it) {
+            fn(it->state, it->diseases);
+        }
+    }
 
-        if (!diseaseFound) {
-            cout << "Disease " << disease << " not found in state " << state << ".\n";
+    /**
+     * Sum, maximum and count of one disease's death counts over a state range and a year
+     * window. Subtrees that fall entirely inside the range are answered from their
+     * precomputed aggregates, so the cost is O(log n) nodes times the window length.
+     * @param low Smallest state (empty = no lower bound).
+     * @param high Largest state prefix (empty = no upper bound).
+     * @param disease The disease id.
+     * @param fromYear First year of the window.
+     * @param toYear Last year of the window.
+     * @return The aggregate over every matching record.
+     */
+    DeathAggregate aggregate(string_view low, string_view high, uint16_t disease, int fromYear, int toYear) const {
+        DeathAggregate total;
+        aggregateHelper(root, low, high, low.empty(), high.empty(), disease, fromYear, toYear, total);
+        return total;
+    }
+
+    /**
+     * The n states with the most deaths for a disease over a year window.
+     * @param low Smallest state (empty = no lower bound).
+     * @param high Largest state prefix (empty = no upper bound).
+     * @param disease The disease id.
+     * @param fromYear First year of the window.
+     * @param toYear Last year of the window.
+     * @param n Number of states to return.
+     * @return (state, aggregate) pairs, largest total first.
+     */
+    vector<pair<string, DeathAggregate>> topStates(string_view low, string_view high, uint16_t disease,
+                                                   int fromYear, int toYear, size_t n) const {
+        vector<pair<string, DeathAggregate>> best;
+        if (n == 0) {
+            return best;
         }
+        topStatesHelper(root, low, high, disease, fromYear, toYear, n, best);
+        sort(best.begin(), best.end(), [](const auto& a, const auto& b) { return a.second.sum > b.second.sum; });
+        return best;
+    }
+
+    /**
+     * Display the death count for a given state and disease.
+     * @param state The state to query.
+     * @param disease The disease to query.
+     */
+    void displayDeathCount(const string& state, const string& disease) const {
+        OutputBuffer out(cout);
+        formatDeathCount(out, state, disease, lookup(*this, state, disease));
     }
 };
+
+// The tree used by the program: state names to CDI records.
+using RBTree = BasicRBTree<string>;
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Read-copy-update publishing with epoch-based reclamation.
+// Readers pin the current epoch and load the published pointer without taking any lock.
+// A writer builds a complete new version off to the side and swaps it in atomically. The old
+// version is freed once every reader that could have seen it has left its read section.
+class EpochDomain {
+public:
+    static constexpr size_t maxReaders = 256;  // Threads that may be inside read sections at once.
+
+private:
+    static constexpr uint64_t idle = 0;        // Slot epoch of a thread outside any read section.
+
+    // One reader thread's pinned epoch, on its own cache line.
+    struct alignas(64) Slot {
+        atomic<uint64_t> epoch{idle};
+        atomic<bool> claimed{false};
+    };
+
+    // Releases a thread's slot when the thread exits.
+    struct ThreadSlot {
+        EpochDomain* domain = nullptr;
+        size_t index = 0;
+        unsigned depth = 0; // Nesting depth of read sections on this thread.
+
+        ~ThreadSlot() {
+            if (domain != nullptr) {
+                domain->slots[index].claimed.store(false, memory_order_release);
+            }
+        }
+    };
+
+    Slot slots[maxReaders];
+    atomic<uint64_t> globalEpoch{1};
+
+    EpochDomain() = default;
+
+    /**
+     * The calling thread's slot, claimed on first use.
+     */
+    ThreadSlot& threadSlot() {
+        thread_local ThreadSlot slot;
+        if (slot.domain == nullptr) {
+            for (size_t i = 0; i < maxReaders; i++) {
+                bool expected = false;
+                if (slots[i].claimed.compare_exchange_strong(expected, true, memory_order_acq_rel)) {
+                    slot.domain = this;
+                    slot.index = i;
+                    return slot;
+                }
+            }
+            throw runtime_error("too many threads reading published data");
+        }
+        return slot;
+    }
+
+public:
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    /**
+     * The process-wide domain.
+     */
+    static EpochDomain& instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    /**
+     * Enter a read section; published pointers loaded afterwards stay valid until exit().
+     */
+    void enter() {
+        ThreadSlot& slot = threadSlot();
+        if (slot.depth++ == 0) {
+            slots[slot.index].epoch.store(globalEpoch.load(), memory_order_seq_cst);
+        }
+    }
+
+    /**
+     * Leave a read section.
+     */
+    void exit() {
+        ThreadSlot& slot = threadSlot();
+        if (--slot.depth == 0) {
+            slots[slot.index].epoch.store(idle, memory_order_release);
+        }
+    }
+
+    /**
+     * Start a new epoch. Call after unpublishing a version.
+     * @return The epoch the unpublished version belongs to.
+     */
+    uint64_t advance() {
+        return globalEpoch.fetch_add(1, memory_order_seq_cst);
+    }
+
+    /**
+     * Whether every reader that may have seen data retired in an epoch has left.
+     * @param epoch The value returned by advance() when the data was retired.
+     */
+    bool quiescent(uint64_t epoch) const {
+        for (const Slot& slot : slots) {
+            uint64_t pinned = slot.epoch.load(memory_order_seq_cst);
+            if (pinned != idle && pinned <= epoch) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// One published version of T. Readers get a Reader that keeps the version alive; publish()
+// replaces it without waiting for them.
+template <typename T>
+class RcuCell {
+private:
+    atomic<T*> current;                   // The published version.
+    mutex writer;                         // Serializes publishers.
+    vector<pair<uint64_t, T*>> retired;   // Unpublished versions and the epoch they were retired in.
+
+    /**
+     * Free every retired version no reader can still hold. Called with writer held.
+     */
+    void reclaim() {
+        EpochDomain& domain = EpochDomain::instance();
+        size_t kept = 0;
+        for (auto& entry : retired) {
+            if (domain.quiescent(entry.first)) {
+                delete entry.second;
+            } else {
+                retired[kept++] = entry;
+            }
+        }
+        retired.resize(kept);
+    }
+
+public:
+    // A read section pinning the version that was current when it started.
+    class Reader {
+    private:
+        const T* version;
+
+    public:
+        explicit Reader(const RcuCell& cell) {
+            EpochDomain::instance().enter();
+            version = cell.current.load(memory_order_seq_cst);
+        }
+
+        ~Reader() {
+            EpochDomain::instance().exit();
+        }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        const T& operator*() const { return *version; }
+        const T* operator->() const { return version; }
+    };
+
+    explicit RcuCell(unique_ptr<T> initial = make_unique<T>()) : current(initial.release()) {}
+
+    RcuCell(const RcuCell&) = delete;
+    RcuCell& operator=(const RcuCell&) = delete;
+
+    ~RcuCell() {
+        delete current.load();
+        for (auto& entry : retired) {
+            delete entry.second;
+        }
+    }
+
+    /**
+     * Enter a read section on the current version.
+     */
+    Reader read() const {
+        return Reader(*this);
+    }
+
+    /**
+     * Replace the published version. Readers already holding the old version keep using it;
+     * it is freed by a later publish() once they have all finished.
+     * @param next The new version.
+     */
+    void publish(unique_ptr<T> next) {
+        lock_guard<mutex> guard(writer);
+        T* old = current.exchange(next.release(), memory_order_seq_cst);
+        retired.emplace_back(EpochDomain::instance().advance(), old);
+        reclaim();
+    }
+
+    // Number of unpublished versions not freed yet.
+    size_t retiredCount() {
+        lock_guard<mutex> guard(writer);
+        return retired.size();
+    }
+};
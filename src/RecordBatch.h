@@ -0,0 +1,93 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "CSVLoader.h"
+#include "Dictionary.h"
+#include "StateRecords.h"
+
+using namespace std;
+
+// Rows decoded from a CSV file, shared by every structure being built from it.
+// decode() interns text columns into chunk-local dictionaries without locking; publish()
+// then rewrites the records to the ids of the shared dictionaries.
+class RecordBatch {
+private:
+    static constexpr uint16_t notMortality = 0xFFFF; // labelCache value for rows that are skipped.
+
+    deque<string> labels; // Lowercase copies of each distinct mortality label.
+    unordered_map<string_view, uint16_t> labelCache; // Raw label -> local mortality id.
+    string lowered; // Scratch buffer for lowercasing.
+    LocalDictionary states, diseases, mortality; // Chunk-local ids, valid until publish().
+    vector<uint16_t> stateIds, diseaseIds, mortalityIds; // Local id -> shared id, filled by publish().
+
+    /**
+     * Lowercase a raw mortality label once and remember its local id.
+     * @param raw The label as written in the file.
+     * @return The local id of the lowercase label, or notMortality if the row is not a mortality record.
+     */
+    uint16_t mortalityLabel(string_view raw) {
+        auto it = labelCache.find(raw);
+        if (it != labelCache.end()) {
+            return it->second;
+        }
+        uint16_t id = notMortality;
+        if (lowerMortality(raw, lowered)) {
+            labels.push_back(lowered);
+            id = mortality.intern(labels.back());
+        }
+        labelCache.emplace(raw, id);
+        return id;
+    }
+
+public:
+    vector<hashTableVars> records; // Decoded mortality rows in file order.
+    size_t lines = 0;              // Number of data lines read, including skipped rows.
+
+    /**
+     * Decode all rows in [begin, end) and append the mortality records to the batch.
+     * The batch must not outlive the buffer the rows come from.
+     * @param begin First byte of the first line to parse.
+     * @param end One past the last byte.
+     */
+    void decode(const char* begin, const char* end) {
+        lines += forEachCSVRow(begin, end, [&](const CSVRow& row) {
+            uint16_t label = mortalityLabel(row.isMortality);
+            if (label != notMortality) {
+                records.emplace_back(states.intern(row.state), diseases.intern(row.disease), row.year,
+                                     row.deathCount, static_cast<uint8_t>(label));
+            }
+        });
+    }
+
+    /**
+     * Intern this batch's names into the shared dictionaries. Call once per batch, in file
+     * order, so ids are handed out in the order names first appear in the file.
+     * @param dict The shared dictionaries.
+     * @param remapNow Whether to rewrite the records immediately; otherwise call remap() later.
+     */
+    void publish(Dictionaries& dict, bool remapNow = true) {
+        stateIds = states.publish(dict.states);
+        diseaseIds = diseases.publish(dict.diseases);
+        mortalityIds = mortality.publish(dict.mortality);
+        if (remapNow) {
+            remap();
+        }
+    }
+
+    /**
+     * Rewrite the records from local ids to the shared ids computed by publish().
+     * Batches can be remapped in parallel.
+     */
+    void remap() {
+        for (hashTableVars& r : records) {
+            r.state = stateIds[r.state];
+            r.disease = diseaseIds[r.disease];
+            r.isMortality = static_cast<uint8_t>(mortalityIds[r.isMortality]);
+        }
+    }
+};
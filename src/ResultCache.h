@@ -0,0 +1,426 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "HashTable.h"
+#include "QueryResult.h"
+#include "Rcu.h"
+
+using namespace std;
+
+// Hit, miss and eviction totals of a ResultCache.
+struct CacheCounters {
+    uint64_t hits = 0;          // Lookups answered from the cache.
+    uint64_t misses = 0;        // Lookups that went to the structure.
+    uint64_t evictions = 0;     // Entries dropped to stay under the memory cap.
+    uint64_t invalidations = 0; // Entries dropped because their state changed.
+    size_t entries = 0;         // Entries currently cached.
+    size_t bytes = 0;           // Memory charged to the cached entries.
+};
+
+// CLOCK cache of (structure, state, disease) lookups in front of the query structures.
+// An entry keeps the QueryResult and its match count, so a repeated query costs one hash
+// probe. Results point into one published version of the structures, so each version has its
+// own cache; a refresh carries the entries of states it didn't touch over to the new version.
+// Safe to use from several threads. Keys are spread over shards by hash bits, and a hit takes
+// no lock: each shard's index is an array of entry pointers probed with atomic loads, and the
+// CLOCK bit is a relaxed atomic. Inserts, evictions and carry-over lock one shard; the entries
+// and index arrays they unlink are freed through EpochDomain once no reader can still see them.
+class ResultCache {
+private:
+    static constexpr size_t nodeOverhead = 64;  // Estimated index, ring and allocation cost per entry.
+    static constexpr size_t shardCount = 16;    // Power of two.
+    static constexpr size_t minIndexSlots = 64; // Smallest index array of a shard.
+
+    // One cached lookup. Immutable once published, except for the CLOCK bit.
+    struct Entry {
+        string key;                     // Engine tag, state, separator and disease.
+        uint64_t hash = 0;              // Hash of key.
+        uint32_t stateLength = 0;       // Length of the state part of the key.
+        QueryResult result;
+        size_t matches = 0;
+        size_t bytes = 0;               // Memory charged for this entry.
+        atomic<bool> referenced{false}; // CLOCK bit, set on hits without the lock.
+    };
+
+    // Open-addressing index of one shard's entries, probed linearly. Writers keep at least a
+    // quarter of the slots empty, so every probe ends.
+    struct Index {
+        size_t mask;                        // Slot count - 1.
+        unique_ptr<atomic<Entry*>[]> slots; // Entry, tombstone() or nullptr (never used).
+
+        explicit Index(size_t count) : mask(count - 1), slots(new atomic<Entry*>[count]) {
+            for (size_t i = 0; i < count; i++) {
+                slots[i].store(nullptr, memory_order_relaxed);
+            }
+        }
+    };
+
+    // A counter bumped by readers, on its own cache line.
+    struct alignas(64) Counter {
+        atomic<uint64_t> value{0};
+    };
+
+    struct alignas(64) Shard {
+        mutex lock;                                  // Guards everything below but index reads and the counters.
+        atomic<Index*> index{nullptr};               // Read without the lock.
+        size_t used = 0;                             // Index slots holding an entry or a tombstone.
+        vector<Entry*> ring;                         // Entries in CLOCK order; nullptr marks a free slot.
+        vector<size_t> freeRing;                     // Free ring slots to reuse.
+        size_t hand = 0;                             // CLOCK hand.
+        size_t entries = 0;                          // Live entries.
+        size_t bytes = 0;                            // Memory charged to the live entries.
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+        vector<pair<uint64_t, Entry*>> retiredEntries; // Unlinked entries and the epoch they were retired in.
+        vector<pair<uint64_t, Index*>> retiredIndexes; // Replaced index arrays, likewise.
+        size_t reclaimAt = 64;                       // Retired count that triggers the next reclaim.
+        Counter hits;
+        Counter misses;
+    };
+
+    atomic<size_t> capacity{0}; // Memory cap in bytes, split evenly over the shards; 0 disables the cache.
+    unique_ptr<Shard[]> shards;
+
+    // Marks an index slot whose entry was removed, so probes continue past it.
+    static Entry* tombstone() {
+        static Entry marker;
+        return &marker;
+    }
+
+    /**
+     * Build the key of a query into a reusable buffer.
+     */
+    static void makeKey(string& key, char engine, string_view state, string_view disease) {
+        key.clear();
+        key.push_back(engine);
+        key.append(state.data(), state.size());
+        key.push_back('\x1f');
+        key.append(disease.data(), disease.size());
+    }
+
+    // Shard of a hash; the index slot comes from the bits above these.
+    Shard& shardFor(uint64_t hash) const {
+        return shards[(hash >> 8) & (shardCount - 1)];
+    }
+
+    static size_t homeSlot(const Index* index, uint64_t hash) {
+        return static_cast<size_t>(hash >> 12) & index->mask;
+    }
+
+    /**
+     * Find an entry by key. Safe without the lock inside a read section.
+     * @return The entry, or nullptr if absent.
+     */
+    static Entry* probe(const Index* index, uint64_t hash, string_view key) {
+        for (size_t i = homeSlot(index, hash);; i = (i + 1) & index->mask) {
+            Entry* entry = index->slots[i].load();
+            if (entry == nullptr) {
+                return nullptr;
+            }
+            if (entry != tombstone() && entry->hash == hash && entry->key == key) {
+                return entry;
+            }
+        }
+    }
+
+    /**
+     * Free the retired entries and indexes no reader can still hold. Called with the shard lock held.
+     */
+    static void reclaim(Shard& shard) {
+        EpochDomain& domain = EpochDomain::instance();
+        // Epochs only grow along each list, so stop at the first one still in use
+        auto freeQuiescent = [&](auto& retired) {
+            size_t done = 0;
+            while (done < retired.size() && domain.quiescent(retired[done].first)) {
+                delete retired[done++].second;
+            }
+            retired.erase(retired.begin(), retired.begin() + static_cast<ptrdiff_t>(done));
+        };
+        freeQuiescent(shard.retiredEntries);
+        freeQuiescent(shard.retiredIndexes);
+        shard.reclaimAt = max<size_t>(64, 2 * (shard.retiredEntries.size() + shard.retiredIndexes.size()));
+    }
+
+    /**
+     * Defer freeing something unlinked from a shard's index. Called with the shard lock held.
+     */
+    template <typename T>
+    static void retire(Shard& shard, vector<pair<uint64_t, T*>>& retired, T* object) {
+        retired.emplace_back(EpochDomain::instance().advance(), object);
+        if (shard.retiredEntries.size() + shard.retiredIndexes.size() >= shard.reclaimAt) {
+            reclaim(shard);
+        }
+    }
+
+    /**
+     * Replace a shard's index with one sized for its live entries plus one, dropping the
+     * tombstones. Called with the shard lock held.
+     */
+    static void rebuildIndex(Shard& shard) {
+        size_t count = minIndexSlots;
+        while (count < 2 * (shard.entries + 1)) {
+            count <<= 1;
+        }
+        Index* index = new Index(count);
+        for (Entry* entry : shard.ring) {
+            if (entry != nullptr) {
+                size_t i = homeSlot(index, entry->hash);
+                while (index->slots[i].load(memory_order_relaxed) != nullptr) {
+                    i = (i + 1) & index->mask;
+                }
+                index->slots[i].store(entry, memory_order_relaxed);
+            }
+        }
+        shard.used = shard.entries;
+        Index* old = shard.index.exchange(index);
+        if (old != nullptr) {
+            retire(shard, shard.retiredIndexes, old);
+        }
+    }
+
+    /**
+     * Drop the live entry in a ring slot. Called with the shard lock held.
+     */
+    static void release(Shard& shard, size_t ringSlot) {
+        Entry* entry = shard.ring[ringSlot];
+        Index* index = shard.index.load(memory_order_relaxed);
+        for (size_t i = homeSlot(index, entry->hash);; i = (i + 1) & index->mask) {
+            if (index->slots[i].load(memory_order_relaxed) == entry) {
+                index->slots[i].store(tombstone());
+                break;
+            }
+        }
+        shard.ring[ringSlot] = nullptr;
+        shard.freeRing.push_back(ringSlot);
+        shard.bytes -= entry->bytes;
+        shard.entries--;
+        retire(shard, shard.retiredEntries, entry);
+    }
+
+    /**
+     * Evict entries in CLOCK order until needed more bytes fit under the shard's cap. Called
+     * with the shard lock held.
+     */
+    static void makeRoom(Shard& shard, size_t needed, size_t cap) {
+        while (shard.bytes + needed > cap && shard.entries > 0) {
+            shard.hand = shard.hand + 1 < shard.ring.size() ? shard.hand + 1 : 0;
+            Entry* entry = shard.ring[shard.hand];
+            if (entry == nullptr) {
+                continue;
+            }
+            if (entry->referenced.load(memory_order_relaxed)) {
+                entry->referenced.store(false, memory_order_relaxed);
+                continue;
+            }
+            release(shard, shard.hand);
+            shard.evictions++;
+        }
+    }
+
+    /**
+     * Add an entry unless it is already present or can't fit. Called with the shard lock held.
+     */
+    void store(Shard& shard, uint64_t hash, const string& key, uint32_t stateLength, const QueryResult& result,
+               size_t matches) {
+        size_t cap = capacity.load(memory_order_relaxed) / shardCount;
+        size_t bytes = sizeof(Entry) + nodeOverhead + key.size();
+        Index* index = shard.index.load(memory_order_relaxed);
+        if (bytes > cap || (index != nullptr && probe(index, hash, key) != nullptr)) {
+            return;
+        }
+        makeRoom(shard, bytes, cap);
+        if (index == nullptr || 4 * (shard.used + 1) > 3 * (index->mask + 1)) {
+            rebuildIndex(shard);
+            index = shard.index.load(memory_order_relaxed);
+        }
+
+        Entry* entry = new Entry;
+        entry->key = key;
+        entry->hash = hash;
+        entry->stateLength = stateLength;
+        entry->result = result;
+        entry->matches = matches;
+        entry->bytes = bytes;
+        if (shard.freeRing.empty()) {
+            shard.ring.push_back(entry);
+        } else {
+            shard.ring[shard.freeRing.back()] = entry;
+            shard.freeRing.pop_back();
+        }
+        // Reuse a tombstone on the probe path, or take the empty slot that ends it
+        for (size_t i = homeSlot(index, hash);; i = (i + 1) & index->mask) {
+            Entry* current = index->slots[i].load(memory_order_relaxed);
+            if (current == nullptr || current == tombstone()) {
+                shard.used += current == nullptr ? 1 : 0;
+                index->slots[i].store(entry, memory_order_release);
+                break;
+            }
+        }
+        shard.bytes += bytes;
+        shard.entries++;
+    }
+
+public:
+    /**
+     * @param bytes Memory cap; 0 disables the cache.
+     */
+    explicit ResultCache(size_t bytes = 0) : capacity(bytes), shards(new Shard[shardCount]) {}
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // Only called once no reader can reach the cache.
+    ~ResultCache() {
+        for (size_t s = 0; s < shardCount; s++) {
+            Shard& shard = shards[s];
+            for (Entry* entry : shard.ring) {
+                delete entry;
+            }
+            for (auto& retired : shard.retiredEntries) {
+                delete retired.second;
+            }
+            for (auto& retired : shard.retiredIndexes) {
+                delete retired.second;
+            }
+            delete shard.index.load();
+        }
+    }
+
+    /**
+     * Change the memory cap, evicting entries if it shrank.
+     * @param bytes Memory cap; 0 disables the cache.
+     */
+    void setCapacity(size_t bytes) {
+        capacity.store(bytes);
+        for (size_t s = 0; s < shardCount; s++) {
+            lock_guard<mutex> guard(shards[s].lock);
+            makeRoom(shards[s], 0, bytes / shardCount);
+        }
+    }
+
+    // Whether lookups go through the cache.
+    bool enabled() const {
+        return capacity.load(memory_order_relaxed) > 0;
+    }
+
+    /**
+     * Answer a query from the cache, or look it up in the structure and remember the result.
+     * @param structure Any structure with find(state) returning const StateRecords*.
+     * @param engine One character naming the structure, so structures don't share entries.
+     * @param state The state to query.
+     * @param disease The disease to query.
+     * @param matches Receives the number of matching records.
+     * @param hit Receives whether the cache answered, if not null.
+     * @return The matching records.
+     */
+    template <typename Structure>
+    QueryResult lookup(const Structure& structure, char engine, string_view state, string_view disease,
+                       size_t& matches, bool* hit = nullptr) {
+        thread_local string key;
+        makeKey(key, engine, state, disease);
+        uint64_t hash = HashTable::hashFunction(key);
+        Shard& shard = shardFor(hash);
+
+        // The read section keeps the entry from being freed while it is copied out
+        EpochDomain& domain = EpochDomain::instance();
+        domain.enter();
+        const Index* index = shard.index.load();
+        Entry* entry = index == nullptr ? nullptr : probe(index, hash, key);
+        if (entry != nullptr) {
+            if (!entry->referenced.load(memory_order_relaxed)) {
+                entry->referenced.store(true, memory_order_relaxed);
+            }
+            matches = entry->matches;
+            QueryResult result = entry->result;
+            domain.exit();
+            shard.hits.value.fetch_add(1, memory_order_relaxed);
+            if (hit != nullptr) {
+                *hit = true;
+            }
+            return result;
+        }
+        domain.exit();
+        shard.misses.value.fetch_add(1, memory_order_relaxed);
+
+        if (hit != nullptr) {
+            *hit = false;
+        }
+        QueryResult result = ::lookup(structure, state, disease);
+        matches = result.size();
+        if (enabled()) {
+            lock_guard<mutex> guard(shard.lock);
+            store(shard, hash, key, static_cast<uint32_t>(state.size()), result, matches);
+        }
+        return result;
+    }
+
+    /**
+     * Fill this (empty) cache with the entries of the previous version's cache whose state was
+     * not changed, looked up again in the new structures. Entries of changed states are dropped.
+     * @param previous The cache of the version being replaced.
+     * @param changedStates States that received new records.
+     * @param resolve Callback (char engine, string_view state, string_view disease) returning
+     *                the QueryResult in the new structures.
+     */
+    template <typename Fn>
+    void carryOver(const ResultCache& previous, const unordered_set<string>& changedStates, Fn&& resolve) {
+        vector<pair<string, uint32_t>> keys;
+        uint64_t dropped = 0;
+        for (size_t s = 0; s < shardCount; s++) {
+            Shard& shard = previous.shards[s];
+            lock_guard<mutex> guard(shard.lock);
+            for (const Entry* entry : shard.ring) {
+                if (entry == nullptr) {
+                    continue;
+                }
+                if (changedStates.count(entry->key.substr(1, entry->stateLength)) != 0) {
+                    dropped++;
+                } else {
+                    keys.emplace_back(entry->key, entry->stateLength);
+                }
+            }
+        }
+        for (const auto& entry : keys) {
+            string_view key(entry.first);
+            string_view state = key.substr(1, entry.second);
+            string_view disease = key.substr(entry.second + 2);
+            QueryResult result = resolve(key[0], state, disease);
+            size_t matches = result.size();
+            uint64_t hash = HashTable::hashFunction(key);
+            Shard& shard = shardFor(hash);
+            lock_guard<mutex> guard(shard.lock);
+            if (enabled()) {
+                store(shard, hash, entry.first, entry.second, result, matches);
+            }
+        }
+        lock_guard<mutex> guard(shards[0].lock);
+        shards[0].invalidations += dropped;
+    }
+
+    /**
+     * Hit, miss and eviction totals of this cache.
+     */
+    CacheCounters counters() const {
+        CacheCounters totals;
+        for (size_t s = 0; s < shardCount; s++) {
+            Shard& shard = shards[s];
+            totals.hits += shard.hits.value.load(memory_order_relaxed);
+            totals.misses += shard.misses.value.load(memory_order_relaxed);
+            lock_guard<mutex> guard(shard.lock);
+            totals.evictions += shard.evictions;
+            totals.invalidations += shard.invalidations;
+            totals.entries += shard.entries;
+            totals.bytes += shard.bytes;
+        }
+        return totals;
+    }
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "StateRecords.h"
+
+using namespace std;
+
+// Materialized totals over the deduplicated records: a dense state x disease x year cube of
+// DeathAggregate cells, plus the national disease x year rollup. Ids come from dictionaries()
+// and are dense, so a cell is found by arithmetic and any total is one array read. The cube is
+// built in one pass over a structure and then kept current from the UpsertResult of each
+// insert; that relies on the KeepLargest rule, under which a stored count never decreases.
+class RollupCube {
+private:
+    vector<DeathAggregate> cells;    // [state][disease][year - firstYear].
+    vector<DeathAggregate> national; // [disease][year - firstYear].
+    size_t stateCount = 0;           // States covered by cells.
+    size_t diseaseCount = 0;         // Diseases covered by cells and national.
+    int firstYear = 0;               // Year of the first year slot.
+    size_t yearCount = 0;            // Year slots per (state, disease).
+
+    size_t cellIndex(uint16_t state, uint16_t disease, int year) const {
+        return (static_cast<size_t>(state) * diseaseCount + disease) * yearCount + static_cast<size_t>(year - firstYear);
+    }
+
+    size_t nationalIndex(uint16_t disease, int year) const {
+        return static_cast<size_t>(disease) * yearCount + static_cast<size_t>(year - firstYear);
+    }
+
+    // Whether (state, disease, year) has a cell.
+    bool covers(uint16_t state, uint16_t disease, int year) const {
+        return state < stateCount && disease < diseaseCount && year >= firstYear &&
+               year < firstYear + static_cast<int>(yearCount);
+    }
+
+    /**
+     * Widen the cube so (state, disease, year) has a cell, moving the existing cells over.
+     * Only new ids or years outside the current span get here.
+     */
+    void grow(uint16_t state, uint16_t disease, int year) {
+        size_t states = max<size_t>(stateCount, static_cast<size_t>(state) + 1);
+        size_t diseases = max<size_t>(diseaseCount, static_cast<size_t>(disease) + 1);
+        int first = yearCount == 0 ? year : min(firstYear, year);
+        int last = yearCount == 0 ? year : max(firstYear + static_cast<int>(yearCount) - 1, year);
+        size_t years = static_cast<size_t>(last - first + 1);
+
+        vector<DeathAggregate> grownCells(states * diseases * years);
+        vector<DeathAggregate> grownNational(diseases * years);
+        size_t shift = static_cast<size_t>(firstYear - first);
+        for (size_t s = 0; s < stateCount; s++) {
+            for (size_t d = 0; d < diseaseCount; d++) {
+                for (size_t y = 0; y < yearCount; y++) {
+                    grownCells[(s * diseases + d) * years + y + shift] = cells[(s * diseaseCount + d) * yearCount + y];
+                }
+            }
+        }
+        for (size_t d = 0; d < diseaseCount; d++) {
+            for (size_t y = 0; y < yearCount; y++) {
+                grownNational[d * years + y + shift] = national[d * yearCount + y];
+            }
+        }
+        cells.swap(grownCells);
+        national.swap(grownNational);
+        stateCount = states;
+        diseaseCount = diseases;
+        firstYear = first;
+        yearCount = years;
+    }
+
+public:
+    /**
+     * Apply the change an upsert made to the records.
+     * @param record The record that was upserted (its state, disease and year pick the cell).
+     * @param change The change reported by StateRecords::upsert.
+     */
+    void apply(const hashTableVars& record, const UpsertResult& change) {
+        if (!change.added && change.current == change.previous) {
+            return;
+        }
+        if (!covers(record.state, record.disease, record.year)) {
+            grow(record.state, record.disease, record.year);
+        }
+        cells[cellIndex(record.state, record.disease, record.year)].apply(change);
+        national[nationalIndex(record.disease, record.year)].apply(change);
+    }
+
+    /**
+     * Replace the contents with the totals of every record of a built structure.
+     * @param structure Any structure with forEach(state, records).
+     */
+    template <typename Structure>
+    void build(const Structure& structure) {
+        clear();
+        structure.forEach([&](const string&, const StateRecords& records) {
+            for (const hashTableVars& record : records) {
+                apply(record, UpsertResult{true, 0, record.deathCount});
+            }
+        });
+    }
+
+    /**
+     * Remove every cell.
+     */
+    void clear() {
+        cells.clear();
+        national.clear();
+        stateCount = diseaseCount = yearCount = 0;
+        firstYear = 0;
+    }
+
+    /**
+     * Totals of one disease in one year over every state.
+     * @return The aggregate (empty if nothing was recorded).
+     */
+    DeathAggregate nationalTotal(uint16_t disease, int year) const {
+        return covers(0, disease, year) ? national[nationalIndex(disease, year)] : DeathAggregate();
+    }
+
+    /**
+     * Totals of one disease in one year for one state.
+     * @return The aggregate (empty if nothing was recorded).
+     */
+    DeathAggregate stateTotal(uint16_t state, uint16_t disease, int year) const {
+        return covers(state, disease, year) ? cells[cellIndex(state, disease, year)] : DeathAggregate();
+    }
+
+    /**
+     * Year-over-year change in total deaths of one disease, nationally.
+     * @return Deaths in year minus deaths in the year before.
+     */
+    long long nationalChange(uint16_t disease, int year) const {
+        return nationalTotal(disease, year).sum - nationalTotal(disease, year - 1).sum;
+    }
+
+    /**
+     * Year-over-year change in total deaths of one disease in one state.
+     * @return Deaths in year minus deaths in the year before.
+     */
+    long long stateChange(uint16_t state, uint16_t disease, int year) const {
+        return stateTotal(state, disease, year).sum - stateTotal(state, disease, year - 1).sum;
+    }
+
+    // Memory held by the cells, in bytes.
+    size_t bytes() const { return (cells.size() + national.size()) * sizeof(DeathAggregate); }
+};
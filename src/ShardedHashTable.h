@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "HashTable.h"
+#include "StateRecords.h"
+
+using namespace std;
+
+// Hash table that accepts inserts from many threads at once. Keys are spread over a
+// power-of-two number of independent HashTable shards by hash bits, and each shard has its
+// own lock, so writers only contend when they hit the same shard. Duplicate records follow
+// the same keep-the-largest-death-count rule as HashTable, so the contents don't depend on
+// the order in which threads get there.
+class ShardedHashTable {
+private:
+    // One sub-table and its lock, on separate cache lines from its neighbours.
+    struct alignas(64) Shard {
+        mutex lock;
+        HashTable table;
+    };
+
+    unique_ptr<Shard[]> shards; // shardCount shards.
+    size_t shardMask;           // shardCount - 1.
+
+    /**
+     * Pick the shard of a key. HashTable uses the top hash bits for the home bucket and the
+     * low 8 bits as a fingerprint, so the shard comes from the bits just above the fingerprint.
+     */
+    Shard& shardFor(string_view key) const {
+        return shards[(HashTable::hashFunction(key) >> 8) & shardMask];
+    }
+
+public:
+    /**
+     * @param shardCount Number of shards; rounded up to a power of two.
+     */
+    explicit ShardedHashTable(size_t shardCount = 64) {
+        size_t count = 1;
+        while (count < shardCount) {
+            count <<= 1;
+        }
+        shards.reset(new Shard[count]);
+        shardMask = count - 1;
+    }
+
+    ShardedHashTable(const ShardedHashTable&) = delete;
+    ShardedHashTable& operator=(const ShardedHashTable&) = delete;
+
+    /**
+     * Insert a record; safe to call from several threads at once.
+     * @param key The key (state) for the record.
+     * @param info The record to insert.
+     */
+    void insertItem(string_view key, const hashTableVars& info) {
+        Shard& shard = shardFor(key);
+        lock_guard<mutex> guard(shard.lock);
+        shard.table.insertItem(key, info);
+    }
+
+    /**
+     * Look up the records of a state. Not safe while inserts are running.
+     * @param key The state.
+     * @return The state's records, or nullptr if the state is not present.
+     */
+    const StateRecords* find(string_view key) const {
+        return shardFor(key).table.find(key);
+    }
+
+    /**
+     * Visit every state and its records, shard by shard. Not safe while inserts are running.
+     * @param fn Callback receiving (const string& state, const StateRecords& records).
+     */
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (size_t i = 0; i <= shardMask; i++) {
+            shards[i].table.forEach(fn);
+        }
+    }
+
+    // Number of states stored in all shards.
+    size_t size() const {
+        size_t total = 0;
+        for (size_t i = 0; i <= shardMask; i++) {
+            total += shards[i].table.size();
+        }
+        return total;
+    }
+
+    // Number of shards.
+    size_t shardCount() const { return shardMask + 1; }
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CSVLoader.h"
+#include "Dictionary.h"
+#include "Hash.h"
+#include "StateRecords.h"
+
+using namespace std;
+
+// Binary snapshot of the deduplicated records, so the program can start without parsing CSV.
+//
+// Layout (little-endian):
+//   SnapshotHeader
+//   string table: for states, diseases, then mortality labels, stringCount[i] entries of
+//                 (uint16 length, bytes), padded with zeros to a multiple of 4 bytes
+//   recordCount SnapshotRecord entries
+// payloadHash is the wyhash of everything after the header.
+namespace snapshot {
+
+static constexpr char magic[8] = {'C', 'D', 'I', 'S', 'N', 'A', 'P', '\0'};
+static constexpr uint32_t version = 2;
+
+struct SnapshotHeader {
+    char magic[8];            // snapshot::magic.
+    uint32_t version;         // Format version; readers reject other versions.
+    uint32_t headerSize;      // sizeof(SnapshotHeader), as a sanity check.
+    uint64_t sourceLines;     // Data lines in the CSV the snapshot was built from.
+    uint64_t sourceBytes;     // Bytes of that CSV that were loaded, so later appends can be read from there.
+    uint64_t recordCount;     // Number of SnapshotRecord entries.
+    uint32_t stringCount[3];  // Entries in the state, disease and mortality string tables.
+    uint32_t stringBytes;     // Size of the string table section, including padding.
+    uint64_t payloadHash;     // wyhash of the string table and records.
+};
+static_assert(sizeof(SnapshotHeader) == 64, "unexpected SnapshotHeader padding");
+
+// On-disk record; same fields as hashTableVars with the padding byte spelled out.
+struct SnapshotRecord {
+    uint16_t state;
+    uint16_t disease;
+    uint16_t year;
+    uint8_t isMortality;
+    uint8_t reserved;  // Always 0.
+    int32_t deathCount;
+};
+static_assert(sizeof(SnapshotRecord) == 12, "unexpected SnapshotRecord padding");
+
+/**
+ * Append one dictionary's names to a string table.
+ */
+inline void appendStrings(const Dictionary& dict, string& table) {
+    for (string_view name : dict.snapshot()) {
+        uint16_t length = static_cast<uint16_t>(name.size());
+        table.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        table.append(name.data(), name.size());
+    }
+}
+
+/**
+ * Read one dictionary's names from a string table and intern them.
+ * @param p Cursor into the string table; advanced past the entries read.
+ * @param end End of the string table.
+ * @param count Number of entries.
+ * @param dict Dictionary to intern into.
+ * @param mapping Receives snapshot id -> dictionary id.
+ * @return False if the table is truncated.
+ */
+inline bool readStrings(const char*& p, const char* end, uint32_t count, Dictionary& dict, vector<uint16_t>& mapping) {
+    mapping.clear();
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t length;
+        if (end - p < static_cast<ptrdiff_t>(sizeof(length))) {
+            return false;
+        }
+        memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        if (end - p < length) {
+            return false;
+        }
+        mapping.push_back(dict.intern(string_view(p, length)));
+        p += length;
+    }
+    return true;
+}
+
+} // namespace snapshot
+
+/**
+ * Write every record of a built structure to a snapshot file.
+ * @param path Output path.
+ * @param structure Any structure with forEach(state, records), e.g. HashTable.
+ * @param sourceLines Number of CSV data lines the structure was built from.
+ * @param sourceBytes Number of CSV bytes (complete lines) the structure was built from.
+ * @param error Receives a message on failure.
+ * @return True on success.
+ */
+template <typename Structure>
+bool writeSnapshot(const string& path, const Structure& structure, uint64_t sourceLines, uint64_t sourceBytes,
+                   string& error) {
+    using namespace snapshot;
+    Dictionaries& dict = dictionaries();
+
+    string strings;
+    appendStrings(dict.states, strings);
+    appendStrings(dict.diseases, strings);
+    appendStrings(dict.mortality, strings);
+    strings.resize((strings.size() + 3) & ~size_t(3), '\0');
+
+    vector<SnapshotRecord> records;
+    structure.forEach([&](const string&, const StateRecords& stateRecords) {
+        for (const hashTableVars& r : stateRecords) {
+            records.push_back({r.state, r.disease, r.year, r.isMortality, 0, r.deathCount});
+        }
+    });
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.sourceLines = sourceLines;
+    header.sourceBytes = sourceBytes;
+    header.recordCount = records.size();
+    header.stringCount[0] = static_cast<uint32_t>(dict.states.size());
+    header.stringCount[1] = static_cast<uint32_t>(dict.diseases.size());
+    header.stringCount[2] = static_cast<uint32_t>(dict.mortality.size());
+    header.stringBytes = static_cast<uint32_t>(strings.size());
+    uint64_t hash = wyhash::hash(strings.data(), strings.size());
+    header.payloadHash = wyhash::hash(records.data(), records.size() * sizeof(SnapshotRecord), hash);
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out.is_open()) {
+        error = "can't open " + path + " for writing";
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(strings.data(), strings.size());
+    out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(SnapshotRecord));
+    if (!out) {
+        error = "write to " + path + " failed";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Map a snapshot file, verify it, intern its strings into dictionaries() and return its records
+ * with ids translated to the dictionaries' ids.
+ * @param path Snapshot path.
+ * @param records Receives the records, grouped by state in the order they were written.
+ * @param sourceLines Receives the CSV line count stored in the snapshot.
+ * @param sourceBytes Receives the CSV byte count stored in the snapshot.
+ * @param error Receives a message on failure.
+ * @return True on success.
+ */
+inline bool readSnapshot(const string& path, vector<hashTableVars>& records, uint64_t& sourceLines,
+                         uint64_t& sourceBytes, string& error) {
+    using namespace snapshot;
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        error = "can't open " + path;
+        return false;
+    }
+
+    SnapshotHeader header;
+    if (file.size() < sizeof(header)) {
+        error = path + " is too small to be a snapshot";
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        error = path + " is not a snapshot file";
+        return false;
+    }
+    if (header.version != version || header.headerSize != sizeof(header)) {
+        error = path + " has snapshot version " + to_string(header.version) + ", expected " + to_string(version);
+        return false;
+    }
+    // Bound the header's counts by the file size before multiplying them
+    uint64_t payload = file.size() - sizeof(header);
+    if (header.stringBytes > payload ||
+        header.recordCount > (payload - header.stringBytes) / sizeof(SnapshotRecord) ||
+        header.stringBytes + header.recordCount * sizeof(SnapshotRecord) != payload) {
+        error = path + " is truncated or has trailing data";
+        return false;
+    }
+
+    const char* strings = file.data() + sizeof(header);
+    const char* recordBytes = strings + header.stringBytes;
+    uint64_t hash = wyhash::hash(strings, header.stringBytes);
+    hash = wyhash::hash(recordBytes, header.recordCount * sizeof(SnapshotRecord), hash);
+    if (hash != header.payloadHash) {
+        error = path + " failed its checksum";
+        return false;
+    }
+
+    Dictionaries& dict = dictionaries();
+    vector<uint16_t> stateIds, diseaseIds, mortalityIds;
+    const char* p = strings;
+    const char* stringsEnd = recordBytes;
+    if (!readStrings(p, stringsEnd, header.stringCount[0], dict.states, stateIds) ||
+        !readStrings(p, stringsEnd, header.stringCount[1], dict.diseases, diseaseIds) ||
+        !readStrings(p, stringsEnd, header.stringCount[2], dict.mortality, mortalityIds)) {
+        error = path + " has a corrupt string table";
+        return false;
+    }
+
+    records.clear();
+    records.reserve(header.recordCount);
+    for (uint64_t i = 0; i < header.recordCount; i++) {
+        SnapshotRecord r;
+        memcpy(&r, recordBytes + i * sizeof(SnapshotRecord), sizeof(r));
+        if (r.state >= stateIds.size() || r.disease >= diseaseIds.size() || r.isMortality >= mortalityIds.size()) {
+            error = path + " has a record with an unknown string id";
+            return false;
+        }
+        records.emplace_back(stateIds[r.state], diseaseIds[r.disease], r.year, r.deathCount,
+                             static_cast<uint8_t>(mortalityIds[r.isMortality]));
+    }
+    sourceLines = header.sourceLines;
+    sourceBytes = header.sourceBytes;
+    return true;
+}
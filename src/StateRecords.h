@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "EnginePolicies.h"
+#include "Stats.h"
+
+using namespace std;
+
+// Structure to hold information about a disease in a particular year and state.
+// Text columns are stored as ids from dictionaries() (see Dictionary.h).
+struct hashTableVars {
+    uint16_t state;        // Interned state id.
+    uint16_t disease;      // Interned disease id.
+    uint16_t year;         // Year of the record.
+    uint8_t isMortality;   // Interned (lowercase) mortality label id.
+    int32_t deathCount;    // Number of deaths reported.
+
+    hashTableVars() : state(0), disease(0), year(0), isMortality(0), deathCount(0) {}
+
+    // Constructor to initialize a disease record.
+    hashTableVars(uint16_t s, uint16_t d, int y, int dc, uint8_t im)
+            : state(s), disease(d), year(static_cast<uint16_t>(y)), isMortality(im), deathCount(dc) {}
+};
+
+// Outcome of StateRecords::upsert, so callers can keep derived totals up to date.
+struct UpsertResult {
+    bool added;        // True if a new record was stored.
+    int32_t previous;  // Death count before the upsert (0 if the record is new).
+    int32_t current;   // Death count after the upsert.
+};
+
+// Sum, maximum and number of death counts over a set of records.
+struct DeathAggregate {
+    long long sum = 0;    // Total deaths.
+    int32_t max = 0;      // Largest single death count (valid when count > 0).
+    long long count = 0;  // Number of records.
+
+    // Add one record's death count.
+    void add(int32_t deathCount) {
+        sum += deathCount;
+        max = (count == 0 || deathCount > max) ? deathCount : max;
+        count++;
+    }
+
+    // Combine with another aggregate.
+    void add(const DeathAggregate& other) {
+        if (other.count == 0) {
+            return;
+        }
+        sum += other.sum;
+        max = (count == 0 || other.max > max) ? other.max : max;
+        count += other.count;
+    }
+
+    // Apply the change reported by an upsert.
+    void apply(const UpsertResult& change) {
+        if (change.added) {
+            add(change.current);
+        } else {
+            sum += change.current - change.previous;
+            max = change.current > max ? change.current : max;
+        }
+    }
+
+    // Mean death count per record.
+    double average() const { return count == 0 ? 0.0 : static_cast<double>(sum) / count; }
+};
+
+// The disease records of one state. Records are kept in insertion order and indexed by
+// disease id; each disease's rows are sorted by (year, isMortality), so both the duplicate
+// check and a (state, disease) query are an array lookup plus a binary search.
+// Copies share their rows until one of them is updated (copy-on-write), so a new engine
+// version copies only the states a refresh touches.
+// Record needs disease, year, isMortality and deathCount members; Dedup (see
+// EnginePolicies.h) decides which of two duplicates is kept.
+template <typename Record, typename Dedup>
+class BasicStateRecords {
+private:
+    struct Rows {
+        vector<Record> records;             // Records in insertion order.
+        vector<vector<uint32_t>> byDisease; // Disease id -> indices into records, sorted by (year, isMortality).
+    };
+    shared_ptr<Rows> data; // Rows shared with copies of this object; never null.
+
+    /**
+     * The rows, copied first if another object still shares them.
+     */
+    Rows& ownRows() {
+        if (data.use_count() > 1) {
+            data = make_shared<Rows>(*data);
+        } else {
+            // Pairs with the release of the last other owner, whose reads must finish before we write
+            atomic_thread_fence(memory_order_acquire);
+        }
+        return *data;
+    }
+
+public:
+    using RecordType = Record;
+    using DedupPolicy = Dedup;
+
+    BasicStateRecords() : data(make_shared<Rows>()) {}
+
+    /**
+     * Insert a record, or update the death count of an existing record with the same
+     * (disease, year, isMortality) when the dedup policy prefers the new count.
+     * @param info The record to insert.
+     * @return Whether a record was added and how the stored death count changed.
+     */
+    UpsertResult upsert(const Record& info) {
+        Rows& own = ownRows();
+        vector<Record>& records = own.records;
+        vector<vector<uint32_t>>& byDisease = own.byDisease;
+        if (info.disease >= byDisease.size()) {
+            byDisease.resize(info.disease + 1);
+        }
+        vector<uint32_t>& rows = byDisease[info.disease];
+        STATS_COUNT(dedupSearches);
+
+        auto pos = lower_bound(rows.begin(), rows.end(), info, [&](uint32_t row, const Record& key) {
+            STATS_COUNT(dedupSteps);
+            const Record& entry = records[row];
+            return entry.year != key.year ? entry.year < key.year : entry.isMortality < key.isMortality;
+        });
+        if (pos != rows.end() && records[*pos].year == info.year && records[*pos].isMortality == info.isMortality) {
+            STATS_COUNT(dedupHits);
+            Record& entry = records[*pos];
+            UpsertResult result{false, entry.deathCount, entry.deathCount};
+            if (Dedup::replaces(entry.deathCount, info.deathCount)) {
+                entry.deathCount = info.deathCount;
+                result.current = info.deathCount;
+            }
+            // Found the duplicate, no need to add a new entry
+            return result;
+        }
+
+        rows.insert(pos, static_cast<uint32_t>(records.size()));
+        records.push_back(info);
+        return {true, 0, info.deathCount};
+    }
+
+    /**
+     * Visit the records of one disease in (year, isMortality) order.
+     * @param disease The disease id to look up.
+     * @param fn Callback receiving a const Record&.
+     * @return The number of records visited.
+     */
+    template <typename Fn>
+    size_t forDisease(uint16_t disease, Fn&& fn) const {
+        const vector<Record>& records = data->records;
+        const vector<vector<uint32_t>>& byDisease = data->byDisease;
+        if (disease >= byDisease.size()) {
+            return 0;
+        }
+        for (uint32_t row : byDisease[disease]) {
+            fn(records[row]);
+        }
+        return byDisease[disease].size();
+    }
+
+    /**
+     * Visit the records of one disease whose year lies in [fromYear, toYear], in year order.
+     * @param disease The disease id to look up.
+     * @param fromYear First year of the window.
+     * @param toYear Last year of the window.
+     * @param fn Callback receiving a const Record&.
+     * @return The number of records visited.
+     */
+    template <typename Fn>
+    size_t forDiseaseInYears(uint16_t disease, int fromYear, int toYear, Fn&& fn) const {
+        const vector<Record>& records = data->records;
+        const vector<vector<uint32_t>>& byDisease = data->byDisease;
+        if (disease >= byDisease.size()) {
+            return 0;
+        }
+        const vector<uint32_t>& rows = byDisease[disease];
+        auto it = lower_bound(rows.begin(), rows.end(), fromYear, [&](uint32_t row, int year) {
+            return records[row].year < year;
+        });
+        size_t visited = 0;
+        for (; it != rows.end() && records[*it].year <= toYear; ++it) {
+            fn(records[*it]);
+            visited++;
+        }
+        return visited;
+    }
+
+    // Iteration over all records in insertion order.
+    typename vector<Record>::const_iterator begin() const { return data->records.begin(); }
+    typename vector<Record>::const_iterator end() const { return data->records.end(); }
+    size_t size() const { return data->records.size(); }
+    bool empty() const { return data->records.empty(); }
+};
+
+// The records of one state as used by every engine: CDI rows, keeping the largest death count.
+using StateRecords = BasicStateRecords<hashTableVars, KeepLargest>;
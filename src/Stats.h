@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+
+using namespace std;
+
+// Hot-path counters for the engines, compiled in only with -DENGINE_STATS.
+// Without it the STATS_* macros expand to nothing, so the engines carry no extra code.
+// Counters are relaxed atomics so the parallel build can update them; totals are exact,
+// but they slow the build down and are meant for diagnosis, not for timing runs.
+#ifdef ENGINE_STATS
+
+// One named counter.
+struct StatCounter {
+    atomic<uint64_t> value{0};
+
+    void add(uint64_t n) { value.fetch_add(n, memory_order_relaxed); }
+
+    void max(uint64_t n) {
+        uint64_t current = value.load(memory_order_relaxed);
+        while (n > current && !value.compare_exchange_weak(current, n, memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t get() const { return value.load(memory_order_relaxed); }
+};
+
+// All engine counters.
+struct EngineStats {
+    StatCounter hashLookups;       // HashTable key lookups (queries and inserts).
+    StatCounter hashProbes;        // Buckets inspected by those lookups.
+    StatCounter hashMaxProbe;      // Longest probe sequence seen by a lookup.
+    StatCounter hashDisplacements; // Robin Hood swaps while placing new keys.
+    StatCounter hashRehashes;      // Probe array resizes.
+    StatCounter treeSearches;      // RBTree descents (queries and inserts).
+    StatCounter treeDepth;         // Nodes visited by those descents.
+    StatCounter treeMaxDepth;      // Deepest descent.
+    StatCounter stringCompares;    // Full key comparisons in the RBTree and Flat Index.
+    StatCounter leftRotations;     // RBTree left rotations.
+    StatCounter rightRotations;    // RBTree right rotations.
+    StatCounter flatSearches;      // Flat Index searches.
+    StatCounter flatSteps;         // Binary search or Eytzinger steps taken by them.
+    StatCounter dedupSearches;     // StateRecords::upsert calls.
+    StatCounter dedupSteps;        // Comparisons made by the duplicate search.
+    StatCounter dedupHits;         // Upserts that found an existing record.
+    StatCounter poolObjects;       // Objects constructed in an ObjectPool.
+    StatCounter poolBlocks;        // Blocks allocated by ObjectPools.
+};
+
+/**
+ * The process-wide counters.
+ */
+inline EngineStats& engineStats() {
+    static EngineStats stats;
+    return stats;
+}
+
+#define STATS_ADD(counter, n) engineStats().counter.add(n)
+#define STATS_MAX(counter, n) engineStats().counter.max(n)
+
+#else
+
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_MAX(counter, n) ((void)0)
+
+#endif
+
+#define STATS_COUNT(counter) STATS_ADD(counter, 1)
+
+/**
+ * Print every counter, with averages per operation.
+ * @param out Stream to write.
+ */
+inline void dumpStats(ostream& out) {
+#ifdef ENGINE_STATS
+    EngineStats& s = engineStats();
+    auto ratio = [](const StatCounter& a, const StatCounter& b) {
+        return b.get() == 0 ? 0.0 : static_cast<double>(a.get()) / b.get();
+    };
+    out << "Engine stats:\n"
+        << "  hash lookups:          " << s.hashLookups.get() << "\n"
+        << "  hash probes:           " << s.hashProbes.get() << " (" << ratio(s.hashProbes, s.hashLookups)
+        << " per lookup, longest " << s.hashMaxProbe.get() << ")\n"
+        << "  hash displacements:    " << s.hashDisplacements.get() << "\n"
+        << "  hash rehashes:         " << s.hashRehashes.get() << "\n"
+        << "  tree searches:         " << s.treeSearches.get() << " (average depth "
+        << ratio(s.treeDepth, s.treeSearches) << ", deepest " << s.treeMaxDepth.get() << ")\n"
+        << "  tree rotations:        " << s.leftRotations.get() << " left, " << s.rightRotations.get() << " right\n"
+        << "  flat index searches:   " << s.flatSearches.get() << " (" << ratio(s.flatSteps, s.flatSearches)
+        << " steps each)\n"
+        << "  string compares:       " << s.stringCompares.get() << "\n"
+        << "  dedup searches:        " << s.dedupSearches.get() << " (" << ratio(s.dedupSteps, s.dedupSearches)
+        << " comparisons each, " << s.dedupHits.get() << " duplicates)\n"
+        << "  pool allocations:      " << s.poolObjects.get() << " objects in " << s.poolBlocks.get() << " blocks\n";
+#else
+    out << "Engine stats are not compiled in; rebuild with -DENGINE_STATS.\n";
+#endif
+}
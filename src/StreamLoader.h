@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "CSVLoader.h"
+#include "Dictionary.h"
+#include "HashTable.h"
+#include "RecordBatch.h"
+
+using namespace std;
+
+// Streaming CSV ingestion for inputs that don't fit in memory, read from a file or a pipe.
+// A reader thread fills a fixed pool of buffers while the calling thread decodes them and folds
+// each row into a HashTable with the usual keep-the-largest-death-count rule. The reader blocks
+// when every buffer is waiting to be decoded, so memory is bounded by the buffer pool plus the
+// distinct records, not by the size of the input.
+
+// Totals reported after a stream has been read.
+struct StreamSummary {
+    uint64_t bytes = 0;         // Bytes consumed, up to the end of the last complete line.
+    uint64_t lines = 0;         // Data lines read, including skipped rows.
+    uint64_t buffers = 0;       // Buffers decoded.
+    uint64_t readerStalls = 0;  // Times the reader had to wait for a free buffer (backpressure).
+    size_t peakBufferBytes = 0; // Largest buffer, which only grows for lines longer than the buffer size.
+};
+
+/**
+ * Peak resident set size of the process so far.
+ * @return Bytes, or 0 where the platform doesn't report it.
+ */
+inline uint64_t peakRSSBytes() {
+#if defined(_WIN32)
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+class StreamLoader {
+private:
+    // One block of input. Holds whole lines only; a partial last line is carried to the next block.
+    struct Block {
+        vector<char> bytes;
+        size_t used = 0;
+    };
+
+    size_t bufferSize;            // Bytes read per block.
+    vector<Block> blocks;         // The fixed pool.
+    deque<Block*> freeBlocks;     // Blocks the reader may fill.
+    deque<Block*> fullBlocks;     // Blocks waiting to be decoded, in input order.
+    bool finished = false;        // Set by the reader after its last block.
+    bool stopping = false;        // Set when the decoder gives up; the reader stops at its next block.
+    mutex lock;                   // Guards the two queues, finished and stopping.
+    condition_variable changed;   // Signalled whenever a queue or finished changes.
+
+    /**
+     * Reader side: fill blocks from the input until it ends.
+     * @param in The input stream.
+     * @param summary Receives the stall count.
+     */
+    void readAll(istream& in, StreamSummary& summary) {
+        string carry; // Partial line left over from the previous block.
+        while (true) {
+            Block* block;
+            {
+                unique_lock<mutex> guard(lock);
+                if (freeBlocks.empty() && !stopping) {
+                    summary.readerStalls++;
+                    changed.wait(guard, [&] { return !freeBlocks.empty() || stopping; });
+                }
+                if (stopping) {
+                    return;
+                }
+                block = freeBlocks.front();
+                freeBlocks.pop_front();
+            }
+
+            // Start with the carried partial line, then top up from the input, growing the
+            // block only when a single line doesn't fit.
+            size_t capacity = max(bufferSize, carry.size() * 2);
+            if (block->bytes.size() < capacity) {
+                block->bytes.resize(capacity);
+            }
+            memcpy(block->bytes.data(), carry.data(), carry.size());
+            in.read(block->bytes.data() + carry.size(), static_cast<streamsize>(block->bytes.size() - carry.size()));
+            size_t filled = carry.size() + static_cast<size_t>(in.gcount());
+            bool atEnd = !in;
+
+            const char* begin = block->bytes.data();
+            const char* stop = atEnd ? begin + filled : lastLineEnd(begin, begin + filled);
+            block->used = static_cast<size_t>(stop - begin);
+            carry.assign(stop, begin + filled - stop);
+
+            lock_guard<mutex> guard(lock);
+            fullBlocks.push_back(block);
+            finished = atEnd;
+            changed.notify_all();
+            if (atEnd) {
+                return;
+            }
+        }
+    }
+
+public:
+    /**
+     * @param blockSize Bytes read from the input at a time.
+     * @param blockCount Blocks in flight; the reader waits when all of them are full.
+     */
+    explicit StreamLoader(size_t blockSize = 1 << 20, size_t blockCount = 4)
+        : bufferSize(max<size_t>(blockSize, 4096)), blocks(max<size_t>(blockCount, 2)) {}
+
+    StreamLoader(const StreamLoader&) = delete;
+    StreamLoader& operator=(const StreamLoader&) = delete;
+
+    /**
+     * Read a CSV (with a header line) from a stream and fold every row into a table.
+     * The names of new states, diseases and labels are interned into dictionaries().
+     * @param in The input; read to the end.
+     * @param table Receives the deduplicated records.
+     * @return What was read.
+     */
+    StreamSummary load(istream& in, HashTable& table) {
+        StreamSummary summary;
+        finished = false;
+        stopping = false;
+        freeBlocks.clear();
+        fullBlocks.clear();
+        for (Block& block : blocks) {
+            freeBlocks.push_back(&block);
+        }
+
+        // Stop and join the reader however decoding ends, including by an exception
+        struct ReaderGuard {
+            StreamLoader& loader;
+            thread reader;
+
+            ~ReaderGuard() {
+                {
+                    lock_guard<mutex> guard(loader.lock);
+                    loader.stopping = true;
+                    loader.changed.notify_all();
+                }
+                reader.join();
+            }
+        } reader{*this, thread([&] { readAll(in, summary); })};
+        bool header = true;
+        while (true) {
+            Block* block;
+            {
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&] { return !fullBlocks.empty() || finished; });
+                if (fullBlocks.empty()) {
+                    break;
+                }
+                block = fullBlocks.front();
+                fullBlocks.pop_front();
+            }
+
+            const char* begin = block->bytes.data();
+            const char* end = begin + block->used;
+            if (header && block->used > 0) {
+                const char* nl = static_cast<const char*>(memchr(begin, '\n', block->used));
+                begin = nl == nullptr ? end : nl + 1;
+                header = false;
+            }
+            // The batch only lives as long as the block its names point into
+            RecordBatch batch;
+            batch.decode(begin, end);
+            batch.publish(dictionaries());
+            vector<string_view> stateNames = dictionaries().states.snapshot();
+            for (const hashTableVars& r : batch.records) {
+                table.insertItem(stateNames[r.state], r);
+            }
+            summary.bytes += block->used;
+            summary.lines += batch.lines;
+            summary.buffers++;
+            summary.peakBufferBytes = max(summary.peakBufferBytes, block->bytes.size());
+
+            lock_guard<mutex> guard(lock);
+            freeBlocks.push_back(block);
+            changed.notify_all();
+        }
+        return summary;
+    }
+};